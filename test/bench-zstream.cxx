@@ -0,0 +1,372 @@
+
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+
+#include "../zstream.hxx"
+
+// Throughput of zostream/zistream for different write/read sizes.
+//
+// usage: bench-zstream [megabytes]
+//
+// The input is some generated text, it is compressed with writes of
+// 1 char, 4 KiB and 1 MiB at a time and then read back with reads of
+// the same sizes. Then the same with ParallelCompressor for a few
+// thread counts, with DefaultCompressor for each level and strategy
+// in a small matrix and with zstd and lz4 if built with them (make
+// ZSTD=1 LZ4=1). Then many short streams are written and read back,
+// each time with new streams and codecs, the same with their memory
+// from a zpool and with one zostream/zistream rebound each time.
+// Up to here everything happens in memory so we measure the zstream
+// and the codecs only. Last a file (in the current directory) is
+// written with ofstream and zfdstream and read with ifstream and
+// zmapstream.
+
+typedef std::chrono::steady_clock bench_clock;
+
+typedef alf::DefaultCompressor<char> compressor_type;
+typedef alf::ParallelCompressor<char> parallel_compressor_type;
+typedef alf::DefaultDecompressor<char> decompressor_type;
+
+static std::string make_text(std::size_t len)
+{
+  static const char * const words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+    "zstream", "buffer", "compress", "decompress", "stream", "data",
+    "log", "record", "error", "warning", "info", "debug", "12345",
+    "67890", "alpha", "beta", "gamma", "delta"
+  };
+  static const std::size_t nwords = sizeof(words) / sizeof(words[0]);
+  std::string s;
+  s.reserve(len + 16);
+  unsigned int seed = 12345;
+  while (s.size() < len) {
+    seed = seed * 1103515245 + 12345;
+    s += words[(seed >> 16) % nwords];
+    s += (seed & 0x1f) == 0 ? '\n' : ' ';
+  }
+  s.resize(len);
+  return s;
+}
+
+static double mb_per_sec(std::size_t len, bench_clock::duration d)
+{
+  double secs = std::chrono::duration<double>(d).count();
+  return secs > 0 ? len / secs / (1024.0 * 1024.0) : 0;
+}
+
+template <typename Compressor>
+static std::string pack(const std::string & text, std::size_t chunk,
+			Compressor & C, bench_clock::duration & d)
+{
+  std::ostringstream out;
+  bench_clock::time_point t0 = bench_clock::now();
+  {
+    alf::zostream<std::ostream,Compressor> z(out, C);
+    const char * p = text.data();
+    const char * e = p + text.size();
+    if (chunk == 1) {
+      while (p < e)
+	z.put(*p++);
+    } else {
+      while (p < e) {
+	std::size_t k = e - p;
+	if (k > chunk) k = chunk;
+	z.write(p, k);
+	p += k;
+      }
+    }
+  }
+  d = bench_clock::now() - t0;
+  return out.str();
+}
+
+template <typename Decompressor = decompressor_type>
+static std::string unpack(const std::string & packed, std::size_t chunk,
+			  bench_clock::duration & d)
+{
+  std::istringstream inp(packed);
+  std::string text;
+  bench_clock::time_point t0 = bench_clock::now();
+  {
+    Decompressor D;
+    alf::zistream<std::istream,Decompressor> z(inp, D);
+    if (chunk == 1) {
+      char c;
+      while (z.get(c))
+	text += c;
+    } else {
+      std::string buf(chunk, '\0');
+      while (z.read(&buf[0], chunk) || z.gcount() > 0)
+	text.append(buf.data(), z.gcount());
+    }
+  }
+  d = bench_clock::now() - t0;
+  return text;
+}
+
+// write and read back n streams of the first len chars of text.
+// how: 0 new streams and codecs for each, 1 the same with a zpool,
+// 2 one zostream and zistream rebound for each.
+static int short_streams(const std::string & text, std::size_t len,
+			 std::size_t n, int how, bench_clock::duration & d)
+{
+  const alf::zoptions zo = alf::zoptions(alf::zoptions::ZLIB, 1);
+  const alf::zoptions zi = alf::zoptions(alf::zoptions::AUTO);
+  alf::zpool pool;
+  alf::zallocator * a = how == 1 ? &pool : 0;
+  std::string back(len, '\0');
+  std::ostringstream out;
+  std::istringstream inp;
+  int bad = 0;
+  bench_clock::time_point t0 = bench_clock::now();
+  if (how == 2) {
+    compressor_type C(zo);
+    decompressor_type D(zi);
+    alf::zostream<std::ostream,compressor_type> zos(out, C);
+    alf::zistream<std::istream,decompressor_type> zis(inp, D);
+    for (std::size_t i = 0; i < n; ++i) {
+      out.str("");
+      zos.write(text.data(), len);
+      zos.rebind(out); // finish the stream, the next goes there too.
+      inp.str(out.str());
+      inp.clear();
+      zis.rebind(inp);
+      zis.read(&back[0], len);
+      bad |= std::size_t(zis.gcount()) != len;
+    }
+  } else {
+    for (std::size_t i = 0; i < n; ++i) {
+      out.str("");
+      {
+	compressor_type C(alf::zoptions(zo).allocator(a));
+	alf::zostream<std::ostream,compressor_type> zos(out, C, a);
+	zos.write(text.data(), len);
+      }
+      inp.str(out.str());
+      inp.clear();
+      decompressor_type D(alf::zoptions(zi).allocator(a));
+      alf::zistream<std::istream,decompressor_type> zis(inp, D, a);
+      zis.read(&back[0], len);
+      bad |= std::size_t(zis.gcount()) != len;
+    }
+  }
+  d = bench_clock::now() - t0;
+  return bad | (back != text.substr(0, len));
+}
+
+// write text to file fn through an OST, 1 MiB at a time.
+template <typename OST>
+static void pack_file(const std::string & text, const char * fn,
+		      bench_clock::duration & d)
+{
+  bench_clock::time_point t0 = bench_clock::now();
+  {
+    OST os(fn);
+    compressor_type C(alf::zoptions(alf::zoptions::ZLIB, 1));
+    {
+      alf::zostream<OST,compressor_type> z(os, C);
+      for (std::size_t i = 0; i < text.size(); i += 1 << 20)
+	z.write(text.data() + i, std::min<std::size_t>(1 << 20,
+						       text.size() - i));
+    }
+  }
+  d = bench_clock::now() - t0;
+}
+
+// read file fn back through an IST, 1 MiB at a time.
+template <typename IST>
+static std::string unpack_file(const char * fn, bench_clock::duration & d)
+{
+  std::string text;
+  std::string buf(1 << 20, '\0');
+  bench_clock::time_point t0 = bench_clock::now();
+  {
+    IST is(fn);
+    decompressor_type D;
+    alf::zistream<IST,decompressor_type> z(is, D);
+    while (z.read(&buf[0], buf.size()) || z.gcount() > 0)
+      text.append(buf.data(), z.gcount());
+  }
+  d = bench_clock::now() - t0;
+  return text;
+}
+
+int main(int argc, const char * argv[])
+{
+  std::size_t mb = argc > 1 ? std::atoi(argv[1]) : 16;
+  if (mb == 0) mb = 16;
+  std::string text = make_text(mb << 20);
+  static const std::size_t chunks[] = { 1, 4096, 1 << 20 };
+  int ret = 0;
+
+  std::printf("%-12s %10s %12s %12s %8s\n",
+	      "chunk", "bytes", "write MB/s", "read MB/s", "ratio");
+  for (std::size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+    std::size_t chunk = chunks[i];
+    bench_clock::duration dw, dr;
+    compressor_type C;
+    std::string packed = pack(text, chunk, C, dw);
+    std::string back = unpack(packed, chunk, dr);
+    const char * ok = "";
+    if (back != text) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    std::printf("%-12zu %10zu %12.1f %12.1f %8.3f%s\n",
+		chunk, text.size(), mb_per_sec(text.size(), dw),
+		mb_per_sec(text.size(), dr),
+		double(packed.size()) / text.size(), ok);
+  }
+
+  static const unsigned threads[] = { 1, 2, 4, 0 };
+  std::printf("\n%-12s %10s %12s %12s %8s\n",
+	      "threads", "bytes", "write MB/s", "read MB/s", "ratio");
+  for (std::size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+    bench_clock::duration dw, dr;
+    parallel_compressor_type C(threads[i]);
+    std::string packed = pack(text, 1 << 20, C, dw);
+    std::string back = unpack(packed, 1 << 20, dr);
+    const char * ok = "";
+    if (back != text) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    std::printf("%-12u %10zu %12.1f %12.1f %8.3f%s\n",
+		C.threads(), text.size(), mb_per_sec(text.size(), dw),
+		mb_per_sec(text.size(), dr),
+		double(packed.size()) / text.size(), ok);
+  }
+
+  static const int levels[] = { 1, 6, 9 };
+  static const struct { int strategy; const char * name; } strategies[] = {
+    { Z_DEFAULT_STRATEGY, "default" },
+    { Z_FILTERED, "filtered" },
+    { Z_HUFFMAN_ONLY, "huffman" },
+    { Z_RLE, "rle" }
+  };
+  std::printf("\n%-6s %-10s %10s %12s %12s %8s\n",
+	      "level", "strategy", "bytes", "write MB/s", "read MB/s", "ratio");
+  for (std::size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+    for (std::size_t j = 0; j < sizeof(strategies) / sizeof(strategies[0]);
+	 ++j) {
+      bench_clock::duration dw, dr;
+      compressor_type C(alf::zoptions(alf::zoptions::ZLIB, levels[i])
+			.strategy(strategies[j].strategy));
+      std::string packed = pack(text, 1 << 20, C, dw);
+      std::string back = unpack(packed, 1 << 20, dr);
+      const char * ok = "";
+      if (back != text) {
+	ok = "  MISMATCH";
+	ret = 1;
+      }
+      std::printf("%-6d %-10s %10zu %12.1f %12.1f %8.3f%s\n",
+		  levels[i], strategies[j].name, text.size(),
+		  mb_per_sec(text.size(), dw), mb_per_sec(text.size(), dr),
+		  double(packed.size()) / text.size(), ok);
+    }
+  }
+
+#if defined(ZSTREAM_WITH_ZSTD) || defined(ZSTREAM_WITH_LZ4)
+  std::printf("\n%-6s %-10s %10s %12s %12s %8s\n",
+	      "codec", "level", "bytes", "write MB/s", "read MB/s", "ratio");
+#endif
+#ifdef ZSTREAM_WITH_ZSTD
+  static const int zstd_levels[] = { -5, 1, 3, 9, 19 };
+  for (std::size_t i = 0; i < sizeof(zstd_levels) / sizeof(zstd_levels[0]);
+       ++i) {
+    typedef alf::ZstdCompressor<char> zstd_compressor_type;
+    bench_clock::duration dw, dr;
+    zstd_compressor_type C(zstd_levels[i]);
+    std::string packed = pack(text, 1 << 20, C, dw);
+    std::string back =
+      unpack<alf::ZstdDecompressor<char> >(packed, 1 << 20, dr);
+    const char * ok = "";
+    if (back != text) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    std::printf("%-6s %-10d %10zu %12.1f %12.1f %8.3f%s\n",
+		"zstd", zstd_levels[i], text.size(),
+		mb_per_sec(text.size(), dw), mb_per_sec(text.size(), dr),
+		double(packed.size()) / text.size(), ok);
+  }
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  static const int lz4_levels[] = { 0, 3, 9 };
+  for (std::size_t i = 0; i < sizeof(lz4_levels) / sizeof(lz4_levels[0]);
+       ++i) {
+    typedef alf::Lz4Compressor<char> lz4_compressor_type;
+    bench_clock::duration dw, dr;
+    lz4_compressor_type C(lz4_levels[i]);
+    std::string packed = pack(text, 1 << 20, C, dw);
+    std::string back =
+      unpack<alf::Lz4Decompressor<char> >(packed, 1 << 20, dr);
+    const char * ok = "";
+    if (back != text) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    std::printf("%-6s %-10d %10zu %12.1f %12.1f %8.3f%s\n",
+		"lz4", lz4_levels[i], text.size(),
+		mb_per_sec(text.size(), dw), mb_per_sec(text.size(), dr),
+		double(packed.size()) / text.size(), ok);
+  }
+#endif
+
+  static const char * const hows[] = { "new", "zpool", "rebind" };
+  std::printf("\n%-12s %10s %12s\n", "streams", "bytes", "streams/s");
+  for (int how = 0; how < 3; ++how) {
+    std::size_t n = 20000, len = 256;
+    bench_clock::duration d;
+    const char * ok = "";
+    if (short_streams(text, len, n, how, d) != 0) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    double secs = std::chrono::duration<double>(d).count();
+    std::printf("%-12s %10zu %12.0f%s\n", hows[how], len,
+		secs > 0 ? n / secs : 0, ok);
+  }
+
+  static const char fn[] = "bench-zstream.tmp";
+  std::printf("\n%-12s %10s %12s %12s\n",
+	      "file", "bytes", "write MB/s", "read MB/s");
+#ifdef ZSTREAM_WITH_POSIX
+  const int nhows = 2;
+#else
+  const int nhows = 1;
+#endif
+  for (int how = 0; how < nhows; ++how) {
+    bench_clock::duration dw, dr;
+    std::string back;
+    if (how == 0) {
+      pack_file<std::ofstream>(text, fn, dw);
+      back = unpack_file<std::ifstream>(fn, dr);
+    }
+#ifdef ZSTREAM_WITH_POSIX
+    else {
+      pack_file<alf::zfdstream>(text, fn, dw);
+      back = unpack_file<alf::zmapstream>(fn, dr);
+    }
+#endif
+    const char * ok = "";
+    if (back != text) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    std::printf("%-12s %10zu %12.1f %12.1f%s\n",
+		how == 0 ? "fstream" : "fd/mmap", text.size(),
+		mb_per_sec(text.size(), dw), mb_per_sec(text.size(), dr), ok);
+  }
+  std::remove(fn);
+  return ret;
+}
@@ -0,0 +1,438 @@
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../zstream.hxx"
+
+// Round trip checks of the parts of zistream the pack/unpack program
+// doesn't get to. Prints each check and exits with the number that
+// failed.
+//
+// usage: check-zstream
+//
+// The seek checks write an index file, check-zstream.idx, in the
+// current directory and remove it again, the zmapstream checks a file
+// check-zstream.tmp.
+
+typedef alf::DefaultCompressor<char> compressor_type;
+typedef alf::DefaultDecompressor<char> decompressor_type;
+typedef alf::zistream<std::istream,decompressor_type> zistream_type;
+
+static int failed = 0;
+
+static void check(bool ok, const char * what)
+{
+  std::printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  if (! ok)
+    ++failed;
+}
+
+static std::string make_text(std::size_t len)
+{
+  static const char * const words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+    "zstream", "buffer", "compress", "decompress", "12345", "67890"
+  };
+  static const std::size_t nwords = sizeof(words) / sizeof(words[0]);
+  std::string s;
+  s.reserve(len + 16);
+  unsigned int seed = 4711;
+  while (s.size() < len) {
+    seed = seed * 1103515245 + 12345;
+    s += words[(seed >> 16) % nwords];
+    s += (seed & 0x1f) == 0 ? '\n' : ' ';
+  }
+  s.resize(len);
+  return s;
+}
+
+static std::string pack(const std::string & text,
+			const alf::zoptions & opt = alf::zoptions())
+{
+  std::ostringstream out;
+  compressor_type C(opt);
+  {
+    alf::zostream<std::ostream,compressor_type> z(out, C);
+    z.write(text.data(), text.size());
+  }
+  return out.str();
+}
+
+// everything z has, in reads of chunk chars.
+static std::string read_all(zistream_type & z, std::size_t chunk)
+{
+  std::string text, buf(chunk, '\0');
+  while (z.read(&buf[0], chunk) || z.gcount() > 0)
+    text.append(buf.data(), z.gcount());
+  return text;
+}
+
+static void check_readahead(const std::string & text)
+{
+  std::string packed = pack(text);
+  static const std::size_t chunks[] = { 1, 4096, 1 << 20 };
+  for (std::size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    zistream_type z(inp, D);
+    z.readahead(3, 16384);
+    std::string back = read_all(z, chunks[i]);
+    char what[64];
+    std::sprintf(what, "readahead, reads of %zu", chunks[i]);
+    check(back == text && z.eof() && z.error() == 0, what);
+  }
+  // a stream with garbage in the middle ends early with an error.
+  std::string bad = packed;
+  for (std::size_t i = bad.size() / 2; i < bad.size() / 2 + 64; ++i)
+    bad[i] = char(i * 7);
+  for (int ra = 0; ra < 2; ++ra) {
+    std::istringstream inp(bad);
+    decompressor_type D;
+    zistream_type z(inp, D);
+    if (ra)
+      z.readahead();
+    std::string back = read_all(z, 4096);
+    check(back.size() < text.size() && z.eof() && z.error() < 0,
+	  ra ? "corrupt stream, readahead" : "corrupt stream");
+  }
+  // a clean end after a rebind forgets the error.
+  {
+    std::istringstream inp(bad), inp2(packed);
+    decompressor_type D;
+    zistream_type z(inp, D);
+    z.readahead();
+    read_all(z, 4096);
+    z.rebind(inp2);
+    std::string back = read_all(z, 4096);
+    check(back == text && z.error() == 0, "rebind after an error");
+  }
+}
+
+// the same for a wchar_t stream.
+static void check_readahead_wide(const std::string & text)
+{
+  typedef alf::DefaultCompressor<wchar_t> wcompressor_type;
+  typedef alf::DefaultDecompressor<wchar_t> wdecompressor_type;
+  std::wstring wtext(text.begin(), text.end());
+  std::ostringstream out;
+  {
+    wcompressor_type C;
+    alf::zostream<std::ostream,wcompressor_type> z(out, C);
+    z.write(wtext.data(), wtext.size());
+  }
+  std::istringstream inp(out.str());
+  wdecompressor_type D;
+  alf::zistream<std::istream,wdecompressor_type> z(inp, D);
+  z.readahead(3, 16384);
+  std::wstring back, buf(4096, L'\0');
+  while (z.read(&buf[0], buf.size()) || z.gcount() > 0)
+    back.append(buf.data(), z.gcount());
+  check(back == wtext && z.eof() && z.error() == 0, "readahead, wchar_t");
+}
+
+// seek to off in z and compare the next n chars with text.
+static bool seek_and_read(zistream_type & z, const std::string & text,
+			  std::size_t off, std::size_t n)
+{
+  if (off + n > text.size())
+    n = text.size() - off;
+  std::string buf(n, '\0');
+  z.clear();
+  if (! z.seekg(off) || std::size_t(z.tellg()) != off)
+    return false;
+  z.read(&buf[0], n);
+  return std::size_t(z.gcount()) == n && buf == text.substr(off, n) &&
+    std::size_t(z.tellg()) == off + n;
+}
+
+static void check_seek(const std::string & text, const char * idxfn)
+{
+  std::string packed = pack(text);
+  const std::size_t offs[] = {
+    0, 1, 12345, 300000, 1 << 20, (1 << 20) + 77, text.size() - 10, 5
+  };
+  const std::size_t noffs = sizeof(offs) / sizeof(offs[0]);
+
+  // without an index, each seek backwards starts over.
+  {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    zistream_type z(inp, D);
+    bool ok = true;
+    for (std::size_t i = 0; i < noffs; ++i)
+      ok = ok && seek_and_read(z, text, offs[i], 1000);
+    check(ok, "seekg without an index");
+  }
+
+  // build an index while reading it all, then save and load it.
+  alf::zindex X(1 << 18);
+  {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    D.index(& X);
+    zistream_type z(inp, D);
+    std::string back = read_all(z, 65536);
+    check(back == text && X.complete() && X.length() == text.size() &&
+	  X.zlength() == packed.size() && X.size() > 4, "index built");
+  }
+  check(X.save(idxfn) == 0, "index saved");
+  alf::zindex Y, Z;
+  check(Y.load(idxfn, packed.size()) == 0 && Y.size() == X.size() &&
+	Y.complete() && Y.length() == X.length(), "index loaded");
+  check(Z.load(idxfn, packed.size() - 1) < 0 && Z.size() == 0,
+	"index for another stream rejected");
+  std::remove(idxfn);
+
+  // seek with the loaded index.
+  {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    D.index(& Y);
+    zistream_type z(inp, D);
+    bool ok = true;
+    for (std::size_t i = 0; i < noffs; ++i)
+      ok = ok && seek_and_read(z, text, offs[i], 1000);
+    check(ok, "seekg with a loaded index");
+  }
+
+  // a short seek back after a bulk read, with and without an index.
+  for (int idx = 0; idx < 2; ++idx) {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    if (idx)
+      D.index(& Y);
+    zistream_type z(inp, D);
+    std::string buf(1 << 20, '\0');
+    z.read(&buf[0], 100);
+    z.read(&buf[0], 1 << 20);
+    std::size_t pos = z.tellg();
+    bool ok = pos == 100 + (1 << 20) &&
+      seek_and_read(z, text, pos - 50, 50) &&
+      seek_and_read(z, text, pos - 5000, 20000);
+    check(ok, idx ? "seekg back after a bulk read, index"
+	  : "seekg back after a bulk read");
+  }
+}
+
+// gzip files with several members, as from cat a.gz b.gz.
+static void check_members(const std::string & text, const char * idxfn)
+{
+  alf::zoptions gz(alf::zoptions::GZIP, 6);
+  std::string a = text.substr(0, 1000000), b = text.substr(1000000);
+  std::string packed = pack(a, gz) + pack(b, gz) + pack("", gz);
+  static const std::size_t chunks[] = { 1, 4096, 1 << 20 };
+  for (std::size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    zistream_type z(inp, D);
+    std::string back = read_all(z, chunks[i]);
+    char what[64];
+    std::sprintf(what, "gzip members, reads of %zu", chunks[i]);
+    check(back == text && z.error() == 0, what);
+  }
+  {
+    // a zlib stream ends at its end, what follows is ignored.
+    std::istringstream inp(pack(a) + std::string(100, 'x'));
+    decompressor_type D;
+    zistream_type z(inp, D);
+    check(read_all(z, 4096) == a && z.error() == 0,
+	  "zlib stream with junk after it");
+  }
+  {
+    std::istringstream inp(packed + std::string(16, '\0'));
+    decompressor_type D;
+    zistream_type z(inp, D);
+    z.readahead();
+    check(read_all(z, 4096) == text && z.error() == 0,
+	  "gzip members with zeros after, readahead");
+  }
+  // an index over both members, saved and loaded, seeks into each.
+  alf::zindex X(1 << 18), Y;
+  {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    D.index(& X);
+    zistream_type z(inp, D);
+    check(read_all(z, 65536) == text && X.complete() &&
+	  X.zlength() == packed.size(), "index over gzip members");
+  }
+  bool ok = X.save(idxfn) == 0 && Y.load(idxfn, packed.size()) == 0;
+  std::remove(idxfn);
+  {
+    std::istringstream inp(packed);
+    decompressor_type D;
+    D.index(& Y);
+    zistream_type z(inp, D);
+    const std::size_t offs[] = {
+      900000, 999990, 1000000, 1500000, 10, text.size() - 100, 700000
+    };
+    for (std::size_t i = 0; i < sizeof(offs) / sizeof(offs[0]); ++i)
+      ok = ok && seek_and_read(z, text, offs[i], 300000);
+    check(ok, "seekg across gzip members, loaded index");
+  }
+}
+
+// ParallelCompressor with the framings and settings zoptions gives.
+static void check_parallel(const std::string & text)
+{
+  alf::zpool pool;
+  alf::zoptions opts[] = {
+    alf::zoptions(),
+    alf::zoptions(alf::zoptions::GZIP, 6),
+    alf::zoptions(alf::zoptions::GZIP, 1).wbits(12).memlevel(4),
+    alf::zoptions(alf::zoptions::RAW, 9).strategy(Z_FILTERED),
+    alf::zoptions(alf::zoptions::ZLIB, 3).wbits(8).allocator(&pool)
+  };
+  static const char * const names[] = {
+    "parallel, zlib", "parallel, gzip", "parallel, gzip small window",
+    "parallel, raw", "parallel, zlib 8 bit window, pool"
+  };
+  for (std::size_t i = 0; i < sizeof(opts) / sizeof(opts[0]); ++i) {
+    std::ostringstream out;
+    {
+      alf::ParallelCompressor<char> C(3, 65536, opts[i]);
+      alf::zostream<std::ostream,alf::ParallelCompressor<char> > z(out, C);
+      z.write(text.data(), text.size());
+    }
+    std::string packed = out.str();
+    std::istringstream inp(packed);
+    alf::zoptions::framing f = opts[i].frame() == alf::zoptions::RAW ?
+      alf::zoptions::RAW : alf::zoptions::AUTO;
+    decompressor_type D(alf::zoptions(f).wbits(15));
+    zistream_type z(inp, D);
+    bool gz = packed.size() > 2 && packed[0] == '\x1f' &&
+      packed[1] == '\x8b';
+    check(read_all(z, 65536) == text && z.error() == 0 &&
+	  gz == (opts[i].frame() == alf::zoptions::GZIP), names[i]);
+  }
+}
+
+#ifdef ZSTREAM_WITH_POSIX
+
+// zmapstream on an empty file and on a packed one.
+static void check_mapstream(const std::string & text, const char * fn)
+{
+  {
+    std::ofstream f(fn, std::ios::binary);
+  }
+  alf::zmapstream ms(fn);
+  char c[16];
+  ms.read(c, sizeof(c));
+  check(ms.is_open() && ms.gcount() == 0 && ! ms, "zmapstream, empty file");
+  ms.close();
+  {
+    std::ofstream f(fn, std::ios::binary);
+    f << pack(text);
+  }
+  ms.open(fn);
+  decompressor_type D;
+  alf::zistream<alf::zmapstream,decompressor_type> z(ms, D);
+  std::string back, buf(65536, '\0');
+  while (z.read(&buf[0], buf.size()) || z.gcount() > 0)
+    back.append(buf.data(), z.gcount());
+  check(back == text && z.error() == 0, "zmapstream, round trip");
+  ms.close();
+  std::remove(fn);
+}
+
+#endif
+
+#if defined(ZSTREAM_WITH_ZSTD) || defined(ZSTREAM_WITH_LZ4)
+
+// text through compressor C and back through decompressor D, false if
+// it isn't the same or if the stream doesn't end cleanly.
+template <typename C, typename D>
+static bool codec_round_trip(const std::basic_string<
+			       typename C::cin_char_type> & text)
+{
+  typedef typename C::cin_char_type char_type;
+  std::ostringstream out;
+  {
+    C c;
+    alf::zostream<std::ostream,C> z(out, c);
+    z.write(text.data(), text.size());
+  }
+  std::istringstream inp(out.str());
+  D d;
+  alf::zistream<std::istream,D> z(inp, d);
+  std::basic_string<char_type> back, buf(4096, char_type());
+  while (z.read(&buf[0], buf.size()) || z.gcount() > 0)
+    back.append(buf.data(), z.gcount());
+  return back == text && z.eof() && z.error() == 0;
+}
+
+// the same for char and wchar_t, straight and through
+// AutoDecompressor, and text cut short must be an error.
+template <template <typename, typename, typename, typename> class C,
+	  template <typename, typename, typename, typename> class D>
+static void check_codec(const std::string & text, const char * name)
+{
+  typedef std::char_traits<char> ctr;
+  typedef std::char_traits<wchar_t> wtr;
+  typedef C<char,ctr,char,ctr> ccompressor_type;
+  typedef C<wchar_t,wtr,char,ctr> wcompressor_type;
+  static const std::size_t lens[] = { 0, 1, 4095, 300000, 3 << 20 };
+  bool ok = true, wok = true, aok = true;
+  for (std::size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+    std::string t = text.substr(0, lens[i]);
+    std::wstring w(t.begin(), t.end());
+    ok = ok && codec_round_trip<ccompressor_type,
+				D<char,ctr,char,ctr> >(t);
+    wok = wok && codec_round_trip<wcompressor_type,
+				  D<wchar_t,wtr,char,ctr> >(w);
+    aok = aok &&
+      codec_round_trip<ccompressor_type,alf::AutoDecompressor<char> >(t) &&
+      codec_round_trip<wcompressor_type,alf::AutoDecompressor<wchar_t> >(w);
+  }
+  char what[64];
+  std::sprintf(what, "%s, char", name);
+  check(ok, what);
+  std::sprintf(what, "%s, wchar_t", name);
+  check(wok, what);
+  std::sprintf(what, "%s, AutoDecompressor", name);
+  check(aok, what);
+
+  std::ostringstream out;
+  {
+    ccompressor_type c;
+    alf::zostream<std::ostream,ccompressor_type> z(out, c);
+    z.write(text.data(), text.size());
+  }
+  std::string packed = out.str();
+  std::istringstream inp(packed.substr(0, packed.size() - 10));
+  D<char,ctr,char,ctr> d;
+  alf::zistream<std::istream,D<char,ctr,char,ctr> > z(inp, d);
+  std::string buf(4096, '\0');
+  std::size_t got = 0;
+  while (z.read(&buf[0], buf.size()) || z.gcount() > 0)
+    got += z.gcount();
+  std::sprintf(what, "%s, truncated frame", name);
+  check(got < text.size() && z.error() < 0, what);
+}
+
+#endif
+
+int main()
+{
+  std::string text = make_text(3 << 20);
+  check_readahead(text);
+  check_readahead_wide(text);
+  check_seek(text, "check-zstream.idx");
+  check_members(text, "check-zstream.idx");
+  check_parallel(text);
+#ifdef ZSTREAM_WITH_POSIX
+  check_mapstream(text, "check-zstream.tmp");
+#endif
+#ifdef ZSTREAM_WITH_ZSTD
+  check_codec<alf::ZstdCompressor,alf::ZstdDecompressor>(text, "zstd");
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  check_codec<alf::Lz4Compressor,alf::Lz4Decompressor>(text, "lz4");
+#endif
+  return failed;
+}
@@ -0,0 +1,297 @@
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../zstream.hxx"
+
+// Throughput and per call latency of zostream/zistream over a matrix
+// of inputs.
+//
+// usage: perf-zstream [megabytes] [level]
+//
+// Three corpora - text, random and repetitive - of the given size in
+// bytes (default 4) are compressed with DefaultCompressor (default
+// level 6) as char, wchar_t and char32_t streams, with writes of 1,
+// 64, 4096 and 65536 chars at a time, and read back with reads of the
+// same size. Each write and read is timed on its own, the table has
+// MB/s (of uncompressed bytes) and the median and 99th percentile time
+// per call. The time per call includes reading the clock, a few tens
+// of ns, which is most of it for small calls.
+//
+// Then the text is done once more for each char type with alf::zstats
+// on the streams and the codecs, for where the time goes: in zlib, in
+// the rest of the codec call, in reading and writing the compressed
+// data and the rest, which is zstreambuf itself and the loop around
+// it. Everything happens in memory.
+
+typedef std::chrono::steady_clock perf_clock;
+
+enum corpus { TEXT, RANDOM, REPETITIVE, NCORPORA };
+
+static const char * const corpus_names[NCORPORA] = {
+  "text", "random", "repetitive"
+};
+
+// n chars of corpus c. Random wide chars are kept below 0x110000 (the
+// unicode range) so that none of them looks like eof.
+template <typename ChT>
+static std::basic_string<ChT> make_corpus(corpus c, std::size_t n)
+{
+  static const char * const words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+    "zstream", "buffer", "compress", "decompress", "stream", "data",
+    "log", "record", "error", "warning", "info", "debug", "12345",
+    "67890", "alpha", "beta", "gamma", "delta"
+  };
+  static const std::size_t nwords = sizeof(words) / sizeof(words[0]);
+  static const char pattern[] = "0123456789 repeat repeat repeat\n";
+  std::basic_string<ChT> s;
+  s.reserve(n + 16);
+  unsigned int seed = 12345;
+  switch (c) {
+  case TEXT:
+    while (s.size() < n) {
+      seed = seed * 1103515245 + 12345;
+      for (const char * w = words[(seed >> 16) % nwords]; *w; ++w)
+	s += ChT(*w);
+      s += ChT((seed & 0x1f) == 0 ? '\n' : ' ');
+    }
+    break;
+  case RANDOM:
+    while (s.size() < n) {
+      seed = seed * 1103515245 + 12345;
+      unsigned long v = seed >> 8;
+      s += ChT(sizeof(ChT) == 1 ? v & 0xff : v % 0x110000);
+    }
+    break;
+  default:
+    while (s.size() < n)
+      for (const char * p = pattern; *p; ++p)
+	s += ChT(*p);
+    break;
+  }
+  s.resize(n);
+  return s;
+}
+
+static double mb_per_sec(std::size_t bytes, double secs)
+{
+  return secs > 0 ? bytes / secs / (1024.0 * 1024.0) : 0;
+}
+
+// the q quantile (0..1) of v, in ns. v is reordered.
+static double quantile(std::vector<double> & v, double q)
+{
+  if (v.empty())
+    return 0;
+  std::size_t k = std::size_t(q * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+// how one direction went, times in ns.
+struct perf_result {
+  double secs;
+  std::vector<double> calls;
+};
+
+template <typename ChT, typename S = alf::nostats>
+struct perf_types {
+  typedef std::char_traits<ChT> traits_type;
+  typedef alf::DefaultCompressor<ChT,traits_type,char,
+				 std::char_traits<char>,S> compressor_type;
+  typedef alf::DefaultDecompressor<ChT,traits_type,char,
+				   std::char_traits<char>,S> decompressor_type;
+  typedef alf::zostream<std::ostream,compressor_type,S> zostream_type;
+  typedef alf::zistream<std::istream,decompressor_type,S> zistream_type;
+};
+
+template <typename ChT, typename S>
+static std::string pack(const std::basic_string<ChT> & text,
+			std::size_t chunk,
+			typename perf_types<ChT,S>::compressor_type & C,
+			perf_result & res, S * zs = 0, S * cs = 0)
+{
+  typedef typename perf_types<ChT,S>::zostream_type zostream_type;
+  std::ostringstream out, sink;
+  res.calls.clear();
+  res.calls.reserve(text.size() / chunk + 1);
+  perf_clock::time_point t0 = perf_clock::now();
+  {
+    zostream_type z(out, C);
+    const ChT * p = text.data();
+    const ChT * e = p + text.size();
+    while (p < e) {
+      std::size_t k = e - p;
+      if (k > chunk) k = chunk;
+      perf_clock::time_point t = perf_clock::now();
+      if (k == 1)
+	z.put(*p);
+      else
+	z.write(p, k);
+      res.calls.push_back(std::chrono::duration<double, std::nano>
+			  (perf_clock::now() - t).count());
+      p += k;
+    }
+    // finish the stream now rather than when z goes away so that it is
+    // in the time and the stats, what goes to sink is thrown away.
+    z.rebind(sink);
+    res.secs =
+      std::chrono::duration<double>(perf_clock::now() - t0).count();
+    if (zs != 0) {
+      *zs = z.stats();
+      *cs = C.stats();
+    }
+  }
+  return out.str();
+}
+
+template <typename ChT, typename S>
+static std::basic_string<ChT> unpack(const std::string & packed,
+				     std::size_t chunk,
+				     typename perf_types<ChT,S>::
+				     decompressor_type & D,
+				     perf_result & res, S * zs = 0, S * ds = 0)
+{
+  typedef typename perf_types<ChT,S>::zistream_type zistream_type;
+  std::istringstream inp(packed);
+  std::basic_string<ChT> text;
+  std::basic_string<ChT> buf(chunk, ChT());
+  res.calls.clear();
+  perf_clock::time_point t0 = perf_clock::now();
+  {
+    zistream_type z(inp, D);
+    for (;;) {
+      perf_clock::time_point t = perf_clock::now();
+      bool ok = chunk == 1 ? bool(z.get(buf[0]))
+	: bool(z.read(&buf[0], chunk));
+      res.calls.push_back(std::chrono::duration<double, std::nano>
+			  (perf_clock::now() - t).count());
+      std::streamsize k = z.gcount();
+      if (k <= 0)
+	break;
+      text.append(buf.data(), k);
+      if (! ok)
+	break;
+    }
+    res.secs =
+      std::chrono::duration<double>(perf_clock::now() - t0).count();
+    if (zs != 0) {
+      *zs = z.stats();
+      *ds = D.stats();
+    }
+  }
+  return text;
+}
+
+// one row of the matrix for each chunk size, returns 1 on a mismatch.
+template <typename ChT>
+static int matrix(corpus c, const char * type_name, std::size_t bytes,
+		  int level)
+{
+  static const std::size_t chunks[] = { 1, 64, 4096, 65536 };
+  typedef perf_types<ChT> T;
+  std::basic_string<ChT> text = make_corpus<ChT>(c, bytes / sizeof(ChT));
+  std::size_t len = text.size() * sizeof(ChT);
+  int ret = 0;
+  for (std::size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+    perf_result w, r;
+    typename T::compressor_type
+      C(alf::zoptions(alf::zoptions::ZLIB, level));
+    std::string packed = pack<ChT,alf::nostats>(text, chunks[i], C, w);
+    typename T::decompressor_type D;
+    std::basic_string<ChT> back =
+      unpack<ChT,alf::nostats>(packed, chunks[i], D, r);
+    const char * ok = "";
+    if (back != text) {
+      ok = "  MISMATCH";
+      ret = 1;
+    }
+    std::printf("%-10s %-8s %6zu %7.3f %10.1f %8.0f %9.0f %10.1f %8.0f "
+		"%9.0f%s\n",
+		corpus_names[c], type_name, chunks[i],
+		double(packed.size()) / len,
+		mb_per_sec(len, w.secs), quantile(w.calls, 0.5),
+		quantile(w.calls, 0.99),
+		mb_per_sec(len, r.secs), quantile(r.calls, 0.5),
+		quantile(r.calls, 0.99), ok);
+  }
+  return ret;
+}
+
+static void breakdown_row(const char * type_name, const char * dir,
+			  std::size_t len, double secs,
+			  const alf::zstats & s, const alf::zstats & z)
+{
+  // zstreambuf's codec time includes zlib's, its io time is
+  // read_in_ or write_out_, what is left is the streambuf itself.
+  double codec = s.seconds(alf::zstats::CODEC);
+  double zlib = z.seconds(alf::zstats::CODEC);
+  double io = s.seconds(alf::zstats::READ) + s.seconds(alf::zstats::WRITE);
+  double rest = secs - codec - io;
+  unsigned long long calls = s[alf::zstats::COMPRESS_CALLS] +
+    s[alf::zstats::DECOMPRESS_CALLS];
+  unsigned long long zcalls = z[alf::zstats::COMPRESS_CALLS] +
+    z[alf::zstats::DECOMPRESS_CALLS];
+  std::printf("%-8s %-5s %9.1f %8llu %8llu %8llu %7.1f%% %7.1f%% %7.1f%% "
+	      "%7.1f%%\n",
+	      type_name, dir, mb_per_sec(len, secs), calls, zcalls,
+	      s[alf::zstats::REALLOCS],
+	      100 * zlib / secs, 100 * (codec - zlib) / secs,
+	      100 * io / secs, 100 * rest / secs);
+}
+
+template <typename ChT>
+static int breakdown(const char * type_name, std::size_t bytes, int level)
+{
+  typedef perf_types<ChT,alf::zstats> T;
+  std::basic_string<ChT> text = make_corpus<ChT>(TEXT, bytes / sizeof(ChT));
+  std::size_t len = text.size() * sizeof(ChT);
+  perf_result w, r;
+  alf::zstats ws, cs, rs, ds;
+  typename T::compressor_type C(alf::zoptions(alf::zoptions::ZLIB, level));
+  std::string packed = pack<ChT,alf::zstats>(text, 4096, C, w, &ws, &cs);
+  typename T::decompressor_type D;
+  std::basic_string<ChT> back =
+    unpack<ChT,alf::zstats>(packed, 4096, D, r, &rs, &ds);
+  breakdown_row(type_name, "write", len, w.secs, ws, cs);
+  breakdown_row(type_name, "read", len, r.secs, rs, ds);
+  return back == text ? 0 : 1;
+}
+
+int main(int argc, const char * argv[])
+{
+  std::size_t mb = argc > 1 ? std::atoi(argv[1]) : 4;
+  if (mb == 0) mb = 4;
+  int level = argc > 2 ? std::atoi(argv[2]) : 6;
+  std::size_t bytes = mb << 20;
+  int ret = 0;
+
+  std::printf("%-10s %-8s %6s %7s %10s %8s %9s %10s %8s %9s\n",
+	      "corpus", "type", "chunk", "ratio", "write MB/s", "p50 ns",
+	      "p99 ns", "read MB/s", "p50 ns", "p99 ns");
+  for (int c = 0; c < NCORPORA; ++c) {
+    ret |= matrix<char>(corpus(c), "char", bytes, level);
+    ret |= matrix<wchar_t>(corpus(c), "wchar_t", bytes, level);
+    ret |= matrix<char32_t>(corpus(c), "char32_t", bytes, level);
+  }
+
+  std::printf("\ntext, 4096 chars a call, share of the time\n");
+  std::printf("%-8s %-5s %9s %8s %8s %8s %8s %8s %8s %8s\n",
+	      "type", "dir", "MB/s", "calls", "zlib", "reallocs",
+	      "in zlib", "codec", "io", "zstream");
+  ret |= breakdown<char>("char", bytes, level);
+  ret |= breakdown<wchar_t>("wchar_t", bytes, level);
+  ret |= breakdown<char32_t>("char32_t", bytes, level);
+  if (ret)
+    std::printf("MISMATCH\n");
+  return ret;
+}
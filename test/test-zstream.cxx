@@ -11,6 +11,7 @@
 
 int pack(const char * gzfn, const char * fn);
 int unpack(const char * fn, const char * gzfn);
+int unpack_any(const char * fn, const char * gzfn);
 
 int main(int argc, const char * argv[])
 {
@@ -38,15 +39,19 @@ int main(int argc, const char * argv[])
     if (std::strcmp(a, "pack") == 0) {
       sprintf(buf, "%s.z", b);
       return pack(buf, b);
-    } else if (std::strcmp(a, "unpack") == 0) {
+    } else if (std::strcmp(a, "unpack") == 0 ||
+	       std::strcmp(a, "auto") == 0) {
+      // auto reads zlib, gzip, zstd or lz4, unpack zlib or gzip.
+      int (*un)(const char *, const char *) =
+	std::strcmp(a, "auto") == 0 ? unpack_any : unpack;
       blen = std::strlen(b);
       if (blen > zlen && std::strcmp(b + blen - zlen, z) == 0) {
 	std::memcpy(buf, b, blen -= zlen);
 	buf[blen] = 0;
-	return unpack(buf, b);
+	return un(buf, b);
       } else {
 	sprintf(buf, "%s.z", b);
-	return unpack(b, buf);
+	return un(b, buf);
       }
     } else {
       alen = std::strlen(a);
@@ -70,7 +75,10 @@ int main(int argc, const char * argv[])
 	b = buf;
       }
       return pack(b, a);
-    } else if (std::strcmp(a, "unpack") == 0) {
+    } else if (std::strcmp(a, "unpack") == 0 ||
+	       std::strcmp(a, "auto") == 0) {
+      int (*un)(const char *, const char *) =
+	std::strcmp(a, "auto") == 0 ? unpack_any : unpack;
       a = argv[2];
       b = argv[3];
       alen = std::strlen(a);
@@ -78,7 +86,7 @@ int main(int argc, const char * argv[])
 	sprintf(buf, "%s.z", a);
 	a = buf;
       }
-      return unpack(b, a);
+      return un(b, a);
     }
     std::cerr << "What do you want me to do with " << a << ", " << argv[2]
 	      << " and " << argv[3] << std::endl;
@@ -110,3 +118,16 @@ int unpack(const char * fn, const char * gzfn)
     out << c;
   return 0;
 }
+
+int unpack_any(const char * fn, const char * gzfn)
+{
+  std::ofstream out(fn);
+  std::ifstream inp(gzfn);
+  // whatever it is, zlib, gzip, zstd or lz4.
+  alf::AutoDecompressor<char> D;
+  alf::zistream<std::ifstream,alf::AutoDecompressor<char>> z(inp, D);
+  char c;
+  while (z.get(c))
+    out << c;
+  return 0;
+}
@@ -3,10 +3,174 @@
 #include <cstring>
 
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "zstream.hxx"
 
+#ifdef ZSTREAM_WITH_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+///////////////////////
+// zstats
+
+void
+alf::zstats::clear()
+{
+  for (int i = 0; i < NCOUNTERS; ++i)
+    c_[i] = 0;
+  for (int i = 0; i < NCLOCKS; ++i)
+    t_[i] = clock_type::duration::zero();
+}
+
+alf::zstats &
+alf::zstats::operator = (const zstats & s)
+{
+  for (int i = 0; i < NCOUNTERS; ++i)
+    c_[i] = s.c_[i];
+  for (int i = 0; i < NCLOCKS; ++i)
+    t_[i] = s.t_[i];
+  return *this;
+}
+
+alf::zstats &
+alf::zstats::operator += (const zstats & s)
+{
+  for (int i = 0; i < NCOUNTERS; ++i)
+    c_[i] += s.c_[i];
+  for (int i = 0; i < NCLOCKS; ++i)
+    t_[i] += s.t_[i];
+  return *this;
+}
+
+std::ostream &
+alf::zstats::print(std::ostream & os) const
+{
+  static const char * const cname[NCOUNTERS] = {
+    "overflows", "underflows", "compress calls", "decompress calls",
+    "flushes", "reads", "writes", "reallocs", "in", "out", "read",
+    "written"
+  };
+  static const char * const tname[NCLOCKS] = { "codec", "read", "write" };
+  for (int i = 0; i < NCOUNTERS; ++i)
+    if (c_[i] != 0)
+      os << cname[i] << ' ' << c_[i] << '\n';
+  for (int i = 0; i < NCLOCKS; ++i)
+    if (t_[i] != clock_type::duration::zero())
+      os << tname[i] << ' ' << seconds(clock(i)) << " s\n";
+  return os;
+}
+
+void *
+alf::zstats::counter_::allocate(std::size_t n)
+{
+  ++s.c_[REALLOCS];
+  return a != 0 ? a->allocate(n) : new char[n];
+}
+
+void
+alf::zstats::counter_::deallocate(void * p)
+{
+  if (a != 0)
+    a->deallocate(p);
+  else
+    delete [] static_cast<char *>(p);
+}
+
+///////////////////////
+// zallocator
+
+// static
+void *
+alf::zallocator::zalloc(void * opaque, unsigned items, unsigned size)
+{
+  try {
+    return static_cast<zallocator *>(opaque)->
+      allocate(std::size_t(items) * size);
+  } catch (...) {
+    return 0; // zlib wants Z_NULL.
+  }
+}
+
+// static
+void
+alf::zallocator::zfree(void * opaque, void * p)
+{
+  static_cast<zallocator *>(opaque)->deallocate(p);
+}
+
+///////////////////////
+// zpool
+
+// Each block has a header in front with its size class so deallocate
+// knows where it goes, big enough to keep the rest aligned.
+namespace {
+
+union zpool_header {
+  std::size_t k;
+  std::max_align_t align;
+};
+
+}
+
+void *
+alf::zpool::allocate(std::size_t n)
+{
+  std::size_t k = 0;
+  while (k < NSIZES - 1 && (std::size_t(1) << (k + MINSHIFT)) < n)
+    ++k;
+  if (k < NSIZES - 1) {
+    std::lock_guard<std::mutex> l(m_);
+    if (! free_[k].empty()) {
+      void * p = free_[k].back();
+      free_[k].pop_back();
+      return p;
+    }
+    n = std::size_t(1) << (k + MINSHIFT);
+  }
+  zpool_header * h =
+    static_cast<zpool_header *>(::operator new(sizeof(zpool_header) + n));
+  h->k = k;
+  return h + 1;
+}
+
+void
+alf::zpool::deallocate(void * p)
+{
+  if (p == 0)
+    return;
+  zpool_header * h = static_cast<zpool_header *>(p) - 1;
+  std::size_t k = h->k;
+  if (k < NSIZES - 1) {
+    std::lock_guard<std::mutex> l(m_);
+    if (free_[k].size() < keep_) {
+      free_[k].push_back(p);
+      return;
+    }
+  }
+  ::operator delete(h);
+}
+
+void
+alf::zpool::trim()
+{
+  std::lock_guard<std::mutex> l(m_);
+  for (std::size_t k = 0; k < NSIZES; ++k) {
+    for (std::size_t i = 0; i < free_[k].size(); ++i)
+      ::operator delete(static_cast<zpool_header *>(free_[k][i]) - 1);
+    free_[k].clear();
+  }
+}
+
 ///////////////////////
 // basic_buffer
 
@@ -24,13 +188,16 @@ alf::basic_buffer::ensure_(std::size_t n)
   // a multiple of 4096 we get u == k + 4096 rather than u == k.
   if (k > u) u = (k + 4096) & -4096;
   std::size_t N = n_*s_, U = u*s_;
-  char * v = new char[U];
+  // no need to clear the new room, nobody reads it before writing it.
+  char * v = alloc_(U);
   if (n_)
     std::memcpy(v, p_, N);
-  std::memset(v + N, 0, U - N);
-  delete [] p_;
+  // borrowed memory belongs to someone else, from now on we have our own.
+  if (own_)
+    free_(p_);
   p_ = v;
   m_ = u;
+  own_ = true;
 }
 
 void
@@ -38,21 +205,628 @@ alf::basic_buffer::shrink_(std::size_t n)
 {
   if (n < m_) {
     if (n == 0) {
-      delete [] p_;
+      if (own_)
+	free_(p_);
       p_ = 0;
       n_ = m_ = 0;
+      own_ = true;
       return;
     }
     std::size_t N = n*s_;
     std::size_t u = n < n_ ? n : n_;
     std::size_t us = u * s_;
-    char * p = new char[N];
+    char * p = alloc_(N);
     if (n_)
       std::memcpy(p, p_, us);
-    if (n_ < n)
-      std::memset(p + us, 0, N - us);
-    delete [] p_;
+    if (own_)
+      free_(p_);
     p_ = p;
+    n_ = u;
+    m_ = n;
+    own_ = true;
+  }
+}
+
+
+///////////////////////
+// zindex
+
+// the last point at or before out, 0 if none.
+const alf::zindex::point *
+alf::zindex::find(unsigned long long out) const
+{
+  std::size_t lo = 0, hi = P.size();
+  // find the first point after out, the one before it is ours.
+  while (lo < hi) {
+    std::size_t mid = lo + ((hi - lo) >> 1);
+    if (P[mid].out <= out)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo == 0 ? 0 : & P[lo - 1];
+}
+
+// The file is "ZIX3" followed by span, length and compressed length
+// (~0 for both if not complete), framing and number of points, then
+// for each point out, in, bits, wlen and wlen bytes of window. Numbers
+// are 8 bytes little endian except framing (255 if not known) and bits
+// which are one byte.
+
+static void
+put_u64_(std::ostream & os, unsigned long long v)
+{
+  char b[8];
+  for (int i = 0; i < 8; ++i, v >>= 8)
+    b[i] = v & 0xff;
+  os.write(b, 8);
+}
+
+static bool
+get_u64_(std::istream & is, unsigned long long & v)
+{
+  unsigned char b[8];
+  if (! is.read(reinterpret_cast<char *>(b), 8))
+    return false;
+  v = 0;
+  for (int i = 8; i-- > 0; )
+    v = (v << 8) | b[i];
+  return true;
+}
+
+int
+alf::zindex::save(const char * fn) const
+{
+  std::ofstream os(fn, std::ios_base::out | std::ios_base::binary);
+  if (! os)
+    return -1;
+  os.write("ZIX3", 4);
+  put_u64_(os, span_);
+  put_u64_(os, complete_ ? len_ : ~0ULL);
+  put_u64_(os, complete_ ? zlen_ : ~0ULL);
+  os.put(char(frame_ < 0 ? 255 : frame_));
+  put_u64_(os, P.size());
+  for (std::size_t i = 0; i < P.size(); ++i) {
+    const point & pt = P[i];
+    put_u64_(os, pt.out);
+    put_u64_(os, pt.in);
+    os.put(char(pt.bits));
+    put_u64_(os, pt.wlen);
+    os.write(reinterpret_cast<const char *>(pt.window), pt.wlen);
+  }
+  return os ? 0 : -1;
+}
+
+int
+alf::zindex::load(const char * fn, unsigned long long zlen)
+{
+  clear();
+  std::ifstream is(fn, std::ios_base::in | std::ios_base::binary);
+  char magic[4];
+  unsigned long long len, zlen_saved, n;
+  int frame;
+  if (! is.read(magic, 4) || std::memcmp(magic, "ZIX3", 4) != 0 ||
+      ! get_u64_(is, span_) || ! get_u64_(is, len) ||
+      ! get_u64_(is, zlen_saved) || (frame = is.get()) < 0 ||
+      ! get_u64_(is, n))
+    return -1;
+  // an index for some other stream.
+  if (len != ~0ULL && zlen_saved != zlen)
+    return -1;
+  for (unsigned long long i = 0; i < n; ++i) {
+    point & pt = add();
+    unsigned long long wlen;
+    int bits = -1;
+    if (! get_u64_(is, pt.out) || ! get_u64_(is, pt.in) ||
+	(bits = is.get()) < 0 || bits > 7 ||
+	! get_u64_(is, wlen) || wlen > WINSIZE ||
+	! is.read(reinterpret_cast<char *>(pt.window), wlen)) {
+      clear();
+      return -1;
+    }
+    pt.bits = bits;
+    pt.wlen = wlen;
+    if (pt.in > zlen) {
+      clear();
+      return -1;
+    }
+  }
+  if (len != ~0ULL)
+    set_complete(len, zlen);
+  frame_ = frame == 255 ? -1 : frame;
+  return 0;
+}
+
+///////////////////////
+// basic_parallel_compressor
+
+alf::basic_parallel_compressor::
+basic_parallel_compressor(unsigned threads, std::size_t blocksz,
+			  const zoptions & opt)
+  : nthreads_(threads), blocksz_(blocksz), opt_(opt), frame_(opt.frame()),
+    ret_(Z_OK), started_(false), check_(0), len_(0), stop_(false)
+{
+  if (frame_ == zoptions::AUTO)
+    frame_ = zoptions::ZLIB;
+  if (nthreads_ == 0)
+    nthreads_ = std::thread::hardware_concurrency();
+  if (nthreads_ == 0)
+    nthreads_ = 1;
+  // the dictionary for a block must fit in the block before.
+  if (blocksz_ < DICTSZ)
+    blocksz_ = DICTSZ;
+  maxjobs_ = nthreads_ << 1;
+  cur_.ensure(blocksz_);
+  for (unsigned i = 0; i < nthreads_; ++i)
+    pool_.push_back(std::thread(&basic_parallel_compressor::worker_, this));
+}
+
+alf::basic_parallel_compressor::~basic_parallel_compressor()
+{
+  {
+    std::lock_guard<std::mutex> l(m_);
+    stop_ = true;
+  }
+  work_.notify_all();
+  // the workers finish what is in todo_ before they stop.
+  for (std::size_t i = 0; i < pool_.size(); ++i)
+    pool_[i].join();
+  for (std::size_t i = 0; i < jobs_.size(); ++i)
+    delete jobs_[i];
+  for (std::size_t i = 0; i < free_.size(); ++i)
+    delete free_[i];
+}
+
+int
+alf::basic_parallel_compressor::compress_(const char * p, std::size_t n,
+					  bool flush)
+{
+  while (n > 0) {
+    std::size_t k = blocksz_ - cur_.len();
+    if (k > n) k = n;
+    std::memcpy(cur_.get(k), p, k);
+    cur_.inclen(k);
+    p += k;
+    n -= k;
+    if (cur_.len() == blocksz_) {
+      submit_(false);
+      // don't let too many blocks pile up.
+      if (collect_(false) < 0)
+	return ret_;
+    }
+  }
+  if (flush)
+    submit_(true);
+  return collect_(flush);
+}
+
+// hand cur_ to the workers as the next block.
+void
+alf::basic_parallel_compressor::submit_(bool last)
+{
+  job * j;
+  if (free_.empty()) {
+    j = new job;
+  } else {
+    j = free_.back();
+    free_.pop_back();
+  }
+  // the block takes over cur_ and dict_ and leaves its old buffers
+  // for us to reuse.
+  j->in.swap(cur_);
+  cur_.clear().ensure(blocksz_);
+  j->dict.swap(dict_);
+  dict_.clear();
+  // the next block uses the end of this one as dictionary, a new
+  // stream starts from scratch.
+  if (! last) {
+    std::size_t len = j->in.len();
+    std::size_t k = len < std::size_t(DICTSZ) ? len : std::size_t(DICTSZ);
+    std::memcpy(dict_.get(k), j->in.data() + len - k, k);
+    dict_.inclen(k);
+  }
+  j->out.clear();
+  j->last = last;
+  j->done = false;
+  j->ret = Z_OK;
+  {
+    std::lock_guard<std::mutex> l(m_);
+    jobs_.push_back(j);
+    todo_.push_back(j);
+  }
+  work_.notify_one();
+}
+
+// move finished blocks to O in order, with header and trailer around
+// each stream. Waits for all blocks if wait_all, otherwise
+// only while there are too many blocks in the air.
+int
+alf::basic_parallel_compressor::collect_(bool wait_all)
+{
+  for (;;) {
+    job * j;
+    {
+      std::unique_lock<std::mutex> l(m_);
+      if (jobs_.empty())
+	break;
+      j = jobs_.front();
+      if (! j->done) {
+	if (! wait_all && jobs_.size() < maxjobs_)
+	  break;
+	done_.wait(l, [j] { return j->done; });
+      }
+      jobs_.pop_front();
+    }
+    if (j->ret < 0 && ret_ == Z_OK)
+      ret_ = j->ret;
+    if (! started_) {
+      header_();
+      started_ = true;
+    }
+    std::size_t len = j->out.len();
+    std::memcpy(O.get(len), j->out.data(), len);
+    O.inclen(len);
+    if (frame_ == zoptions::GZIP)
+      check_ = crc32_combine(check_, j->check, j->in.len());
+    else
+      check_ = adler32_combine(check_, j->check, j->in.len());
+    len_ += j->in.len();
+    if (j->last) {
+      trailer_();
+      started_ = false;
+    }
+    free_.push_back(j);
+  }
+  return ret_;
+}
+
+// the zlib or gzip header for a new stream, what deflate would write.
+void
+alf::basic_parallel_compressor::header_()
+{
+  int level = opt_.level() < 0 ? 6 : opt_.level();
+  bool fast = opt_.strategy() >= Z_HUFFMAN_ONLY || level < 2;
+  if (frame_ == zoptions::GZIP) {
+    // no name, no time, unknown os.
+    static const char hdr[10] = {
+      char(0x1f), char(0x8b), 8, 0, 0, 0, 0, 0, 0, char(255)
+    };
+    char * q = O.get(10);
+    std::memcpy(q, hdr, 10);
+    q[8] = level == 9 ? 2 : fast ? 4 : 0;
+    O.inclen(10);
+    check_ = crc32(0, 0, 0);
+  } else if (frame_ == zoptions::ZLIB) {
+    // the window (deflate makes 8 into 9) and the level for FLEVEL.
+    int w = opt_.wbits() < 9 ? 9 : opt_.wbits();
+    unsigned char cmf = ((w - 8) << 4) | 8;
+    unsigned char flg = (fast ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    flg += 31 - ((cmf << 8) + flg) % 31;
+    char * q = O.get(2);
+    q[0] = cmf;
+    q[1] = flg;
+    O.inclen(2);
+    check_ = adler32(0, 0, 0);
+  }
+  len_ = 0;
+}
+
+// the trailer at the end of a stream.
+void
+alf::basic_parallel_compressor::trailer_()
+{
+  if (frame_ == zoptions::GZIP) {
+    // crc32 and length, least significant byte first.
+    char * q = O.get(8);
+    for (int i = 0; i < 4; ++i) {
+      q[i] = (check_ >> (8 * i)) & 0xff;
+      q[4 + i] = (len_ >> (8 * i)) & 0xff;
+    }
+    O.inclen(8);
+  } else if (frame_ == zoptions::ZLIB) {
+    // adler32 of the whole stream, most significant byte first.
+    char * q = O.get(4);
+    q[0] = (check_ >> 24) & 0xff;
+    q[1] = (check_ >> 16) & 0xff;
+    q[2] = (check_ >> 8) & 0xff;
+    q[3] = check_ & 0xff;
+    O.inclen(4);
+  }
+}
+
+void
+alf::basic_parallel_compressor::worker_()
+{
+  z_stream Z;
+  std::memset(&Z, 0, sizeof(Z));
+  // zlib's own memory from the allocator if we have one.
+  if (opt_.allocator() != 0) {
+    Z.zalloc = zallocator::zalloc;
+    Z.zfree = zallocator::zfree;
+    Z.opaque = opt_.allocator();
+  }
+  // raw deflate, collect_ writes the header and trailer. Raw deflate
+  // can't do a window of 8 bits, 9 is what zlib would use anyway.
+  int w = opt_.wbits() < 9 ? 9 : opt_.wbits();
+  int r = deflateInit2(&Z, opt_.level(), Z_DEFLATED, -w,
+		       opt_.memlevel(), opt_.strategy());
+  for (;;) {
+    job * j;
+    {
+      std::unique_lock<std::mutex> l(m_);
+      work_.wait(l, [this] { return stop_ || ! todo_.empty(); });
+      if (todo_.empty())
+	break;
+      j = todo_.front();
+      todo_.pop_front();
+    }
+    int k = r;
+    if (k == Z_OK)
+      k = deflateReset(&Z);
+    if (k == Z_OK && j->dict.len() > 0)
+      k = deflateSetDictionary(&Z,
+			       reinterpret_cast<const Bytef *>(j->dict.data()),
+			       j->dict.len());
+    if (k == Z_OK) {
+      Z.next_in = reinterpret_cast<Bytef *>(j->in.data());
+      Z.avail_in = j->in.len();
+      // all but the last block end on a byte boundary so that the
+      // next block can follow right after.
+      int flush = j->last ? Z_FINISH : Z_SYNC_FLUSH;
+      std::size_t want = deflateBound(&Z, j->in.len()) + 16;
+      do {
+	Bytef * q = reinterpret_cast<Bytef *>(j->out.get(want));
+	Z.next_out = q;
+	Z.avail_out = j->out.avail();
+	k = deflate(&Z, flush);
+	j->out.inclen(Z.next_out - q);
+      } while (k == Z_OK && (Z.avail_in > 0 || Z.avail_out == 0));
+      if (k == Z_STREAM_END || k == Z_BUF_ERROR)
+	k = Z_OK;
+    }
+    const Bytef * in = reinterpret_cast<const Bytef *>(j->in.data());
+    if (frame_ == zoptions::GZIP)
+      j->check = crc32(crc32(0, 0, 0), in, j->in.len());
+    else
+      j->check = adler32(adler32(0, 0, 0), in, j->in.len());
+    j->ret = k;
+    {
+      std::lock_guard<std::mutex> l(m_);
+      j->done = true;
+    }
+    done_.notify_all();
+  }
+  if (r == Z_OK)
+    deflateEnd(&Z);
+}
+
+#ifdef ZSTREAM_WITH_POSIX
+
+///////////////////////
+// zmapstream
+
+int
+alf::zmapstream::open(const char * fn)
+{
+  close();
+  int fd = ::open(fn, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  n_ = st.st_size;
+  // an empty file can't be mapped but is fine to read.
+  if (n_ != 0) {
+    void * m = mmap(0, n_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+      ::close(fd);
+      n_ = 0;
+      return -1;
+    }
+    // we read it from start to end, once.
+    madvise(m, n_, MADV_SEQUENTIAL);
+    p_ = static_cast<const char_type *>(m);
   }
+  // the mapping stays when the descriptor goes.
+  ::close(fd);
+  pos_ = 0;
+  gcount_ = 0;
+  open_ = true;
+  fail_ = false;
+  return 0;
+}
+
+void
+alf::zmapstream::close()
+{
+  if (p_ != 0)
+    munmap(const_cast<char_type *>(p_), n_);
+  p_ = 0;
+  n_ = pos_ = 0;
+  gcount_ = 0;
+  open_ = false;
+  fail_ = true;
+}
+
+std::streamsize
+alf::zmapstream::view(const char_type * & p, std::size_t n)
+{
+  if (! open_)
+    return -1;
+  std::size_t k = n_ - pos_;
+  if (k > n) k = n;
+  p = p_ + pos_;
+  pos_ += k;
+  return k;
+}
+
+alf::zmapstream &
+alf::zmapstream::read(char_type * p, std::streamsize n)
+{
+  gcount_ = 0;
+  if (fail_ || n <= 0)
+    return *this;
+  std::size_t k = n_ - pos_;
+  if (k > std::size_t(n)) k = n;
+  // like an istream, a short read fails. At the end (or in an empty
+  // file, where p_ is 0) there is nothing to copy.
+  if (k < std::size_t(n))
+    fail_ = true;
+  if (k == 0)
+    return *this;
+  std::memcpy(p, p_ + pos_, k);
+  pos_ += k;
+  gcount_ = k;
+  return *this;
+}
+
+alf::zmapstream &
+alf::zmapstream::seekg(std::streamoff off)
+{
+  if (fail_ || off < 0 || std::size_t(off) > n_)
+    fail_ = true;
+  else
+    pos_ = off;
+  return *this;
+}
+
+///////////////////////
+// zfdstream
+
+int
+alf::zfdstream::open(const char * fn)
+{
+  close();
+  int fd = ::open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    return -1;
+  if (attach(fd) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  own_ = true;
+  return 0;
+}
+
+int
+alf::zfdstream::attach(int fd)
+{
+  close();
+  if (fd < 0)
+    return -1;
+  fd_ = fd;
+  own_ = false;
+  n_ = 0;
+  if (m_ == 0)
+    m_ = DEFAULT_BUFSZ;
+  fail_ = start_() < 0;
+  return fail_ ? -1 : 0;
+}
+
+int
+alf::zfdstream::close()
+{
+  if (fd_ < 0)
+    return 0;
+  int r = fail_ ? -1 : 0;
+  if (n_ != 0 && write_(b_, n_) < 0)
+    r = -1;
+  n_ = 0;
+  if (own_ && ::close(fd_) < 0)
+    r = -1;
+  fd_ = -1;
+  own_ = false;
+  fail_ = true;
+  free(b_);
+  b_ = 0;
+  return r;
+}
+
+// the buffer, page aligned so the kernel can take it as it is.
+int
+alf::zfdstream::start_()
+{
+  if (b_ != 0)
+    return 0;
+  void * b;
+  if (posix_memalign(&b, 4096, m_) != 0)
+    return -1;
+  b_ = static_cast<char *>(b);
+  return 0;
+}
+
+// write all n bytes at p, < 0 if we can't.
+int
+alf::zfdstream::write_(const char * p, std::size_t n)
+{
+  while (n > 0) {
+    ssize_t k = ::write(fd_, p, n);
+    if (k < 0) {
+      if (errno == EINTR)
+	continue;
+      fail_ = true;
+      return -1;
+    }
+    p += k;
+    n -= k;
+  }
+  return 0;
+}
+
+alf::zfdstream::char_type *
+alf::zfdstream::reserve(std::size_t & n)
+{
+  if (fail_)
+    return 0;
+  if (n_ == m_) {
+    if (write_(b_, n_) < 0)
+      return 0;
+    n_ = 0;
+  }
+  n = m_ - n_;
+  return b_ + n_;
+}
+
+alf::zfdstream &
+alf::zfdstream::write(const char_type * p, std::streamsize n)
+{
+  if (fail_ || n <= 0)
+    return *this;
+  std::size_t k = n;
+  while (k > 0) {
+    // whole blocks go straight out when there is nothing before them.
+    if (n_ == 0 && k >= m_) {
+      std::size_t u = k - k % m_;
+      if (write_(p, u) < 0)
+	return *this;
+      p += u;
+      k -= u;
+      continue;
+    }
+    std::size_t u = m_ - n_;
+    if (u > k) u = k;
+    std::memcpy(b_ + n_, p, u);
+    n_ += u;
+    p += u;
+    k -= u;
+    if (n_ == m_) {
+      if (write_(b_, n_) < 0)
+	return *this;
+      n_ = 0;
+    }
+  }
+  return *this;
+}
+
+alf::zfdstream &
+alf::zfdstream::flush()
+{
+  if (! fail_ && n_ != 0 && write_(b_, n_) == 0)
+    n_ = 0;
+  return *this;
 }
 
+#endif // ZSTREAM_WITH_POSIX
@@ -5,8 +5,33 @@
 
 #include "zlib.h"
 
+// build with -DZSTREAM_WITH_ZSTD and/or -DZSTREAM_WITH_LZ4 (and link
+// with -lzstd, -llz4) for the zstd and lz4 compressors/decompressors.
+#ifdef ZSTREAM_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+// zmapstream and zfdstream need mmap and write(2), they are there on
+// unix like systems. Build with -DZSTREAM_WITHOUT_POSIX to leave them
+// out anyway.
+#if ! defined(ZSTREAM_WITHOUT_POSIX) && \
+  (defined(__unix__) || defined(__unix) || defined(__APPLE__))
+#define ZSTREAM_WITH_POSIX
+#endif
+
 #include <string>
 #include <iostream>
+#include <type_traits>
+#include <chrono>
+#include <utility>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace alf {
 
@@ -42,6 +67,8 @@ namespace alf {
 ** DefaultCompressor/DefaultDecompressor - zlib gzip compression/decompression.
 ** NoCompressor/NoDecompressor - dummy, no compression/decompression.
 ** FailCompressor/FailDecompressor - dummy - always fails.
+** ParallelCompressor - zlib/gzip compression on several threads, the
+**    output is read by DefaultDecompressor.
 **
 ** Underlying the istream/ostreams are a zstreambuf and it will use
 ** FailCompressor as the compressor for zistream and FailDecompressor
@@ -141,18 +168,76 @@ namespace alf {
 //   It is possible to have one class have all methods and so it can be
 //   used as both compressor and decompressor for zstream.
 //
+//   A compressor/decompressor may in addition have span versions of
+//   compress/decompress, zstreambuf detects them at compile time and
+//   uses them instead of the buffer versions. They work directly on
+//   memory given by the caller, so zstreambuf can let them read from
+//   its put area or the user's memory and write straight into the
+//   buffer it writes to the attached stream and vice versa - no
+//   buffers of their own and no copying.
+//
+//      zresult compress(span<const cin_char_type> in,
+//                       span<cout_char_type> out,
+//                       bool flush);
+//
+//      zresult decompress(span<const din_char_type> in,
+//                         span<dout_char_type> out,
+//                         bool flush);
+//
+//   They take what they can from in and write what fits in out and
+//   tell how much of each they used in zresult::consumed and
+//   zresult::produced (counted in chars of the respective type).
+//   Input not consumed is given again, first in the next call.
+//   When out is not filled up and all of in is consumed the call is
+//   done, if out is filled up it is called again with more room.
+//   zresult::ret < 0 is an error, > 0 means end of the compressed
+//   stream: decompress has seen it, compress has written all of it
+//   (after a flush) and won't be called again for this flush. An
+//   empty in does not reset anything here, flush is only what the
+//   flush argument says.
+//
+//   A decompressor that can start over at any position in the
+//   uncompressed data can have
+//
+//      long long seek(unsigned long long off);
+//
+//   off is a byte offset in the uncompressed data, the decompressor
+//   gets ready so that the next byte it gives out is the one at off
+//   and returns the byte offset in the compressed stream where
+//   zstreambuf should start feeding it data, < 0 if it can't.
+//   zstreambuf detects it (has_seek) and then supports seekg.
+//
+//   A compressor/decompressor that can forget the stream it is in the
+//   middle of and start over can have
+//
+//      X & reset();
+//
+//   zstreambuf::rebind calls it (has_reset) so the same object can go
+//   on with a new stream without being made again.
+//
+//   What zstreambuf counts with a stats policy (see zstats) is from
+//   its side of the calls. A compressor/decompressor that wants to say
+//   more keeps its own, DefaultCompressor and DefaultDecompressor take
+//   the policy as their last template argument and count zlib's part.
+//
+
+class nostats;
+class zstats;
 
 // some compressors and decompressors to use.
+// S is nostats or zstats, see zstats.
 template <typename IChT,
 	  typename ITrT = std::char_traits<IChT>,
 	  typename OChT = char,
-	  typename OTrT = std::char_traits<OChT> >
+	  typename OTrT = std::char_traits<OChT>,
+	  typename S = nostats>
 class DefaultCompressor;
 
 template <typename OChT,
 	  typename OTrT = std::char_traits<OChT>,
 	  typename IChT = char,
-	  typename ITrT = std::char_traits<IChT> >
+	  typename ITrT = std::char_traits<IChT>,
+	  typename S = nostats>
 class DefaultDecompressor;
 
 template <typename IChT,
@@ -179,6 +264,300 @@ template <typename OChT,
 	  typename ITrT = std::char_traits<IChT> >
 class FailDecompressor;
 
+template <typename IChT,
+	  typename ITrT = std::char_traits<IChT>,
+	  typename OChT = char,
+	  typename OTrT = std::char_traits<OChT> >
+class ParallelCompressor;
+
+template <typename OChT,
+	  typename OTrT = std::char_traits<OChT>,
+	  typename IChT = char,
+	  typename ITrT = std::char_traits<IChT> >
+class AutoDecompressor;
+
+#ifdef ZSTREAM_WITH_ZSTD
+template <typename IChT,
+	  typename ITrT = std::char_traits<IChT>,
+	  typename OChT = char,
+	  typename OTrT = std::char_traits<OChT> >
+class ZstdCompressor;
+
+template <typename OChT,
+	  typename OTrT = std::char_traits<OChT>,
+	  typename IChT = char,
+	  typename ITrT = std::char_traits<IChT> >
+class ZstdDecompressor;
+#endif
+
+#ifdef ZSTREAM_WITH_LZ4
+template <typename IChT,
+	  typename ITrT = std::char_traits<IChT>,
+	  typename OChT = char,
+	  typename OTrT = std::char_traits<OChT> >
+class Lz4Compressor;
+
+template <typename OChT,
+	  typename OTrT = std::char_traits<OChT>,
+	  typename IChT = char,
+	  typename ITrT = std::char_traits<IChT> >
+class Lz4Decompressor;
+#endif
+
+// a piece of memory given to the span versions of compress/decompress.
+template <typename T>
+class span {
+public:
+
+  typedef T value_type;
+
+  span() : p_(0), n_(0) { }
+  span(T * p, std::size_t n) : p_(p), n_(n) { }
+
+  T * data() const { return p_; }
+  std::size_t len() const { return n_; }
+
+private:
+
+  T * p_;
+  std::size_t n_;
+
+}; // end of class span
+
+// what the span versions of compress/decompress return.
+struct zresult {
+  std::size_t consumed; // chars taken from in.
+  std::size_t produced; // chars written to out.
+  int ret; // < 0 error, > 0 end of stream, 0 otherwise.
+};
+
+// has_span_compress<C>::value is true if C has the span version of
+// compress, has_span_decompress<D>::value ditto for decompress.
+template <typename C, typename = void>
+struct has_span_compress : std::false_type { };
+
+template <typename C>
+struct has_span_compress<C,
+  std::void_t<decltype(std::declval<C &>().compress
+		       (std::declval<span<const typename C::cin_char_type> >(),
+			std::declval<span<typename C::cout_char_type> >(),
+			false))> >
+  : std::true_type { };
+
+template <typename D, typename = void>
+struct has_span_decompress : std::false_type { };
+
+template <typename D>
+struct has_span_decompress<D,
+  std::void_t<decltype(std::declval<D &>().decompress
+		       (std::declval<span<const typename D::din_char_type> >(),
+			std::declval<span<typename D::dout_char_type> >(),
+			false))> >
+  : std::true_type { };
+
+template <typename D, typename = void>
+struct has_seek : std::false_type { };
+
+template <typename D>
+struct has_seek<D,
+  std::void_t<decltype(std::declval<D &>().seek
+		       (std::declval<unsigned long long>()))> >
+  : std::true_type { };
+
+// has_view<IST>::value is true if the istream can lend zstreambuf its
+// memory instead of copying data out with read():
+//
+//    std::streamsize view(const char_type * & p, std::size_t n);
+//
+// p gets the next (at most n) chars, valid until the next call, the
+// chars are taken and it returns how many, 0 at the end. See zmapstream.
+template <typename IST, typename = void>
+struct has_view : std::false_type { };
+
+template <typename IST>
+struct has_view<IST,
+  std::void_t<decltype(std::declval<IST &>().view
+		       (std::declval<const typename IST::char_type * &>(),
+			std::declval<std::size_t>()))> >
+  : std::true_type { };
+
+// has_reserve<OST>::value is true if the ostream lets zstreambuf
+// compress straight into its memory instead of giving it data with
+// write():
+//
+//    char_type * reserve(std::size_t & n);
+//    void commit(std::size_t n);
+//
+// reserve returns where the next chars go and sets n to the room
+// there (at least 1), 0 on error; commit says how many of them were
+// written. See zfdstream.
+template <typename OST, typename = void>
+struct has_reserve : std::false_type { };
+
+template <typename OST>
+struct has_reserve<OST,
+  std::void_t<decltype(std::declval<OST &>().reserve
+		       (std::declval<std::size_t &>())),
+	      decltype(std::declval<OST &>().commit(std::size_t()))> >
+  : std::true_type { };
+
+template <typename T, typename = void>
+struct has_reset : std::false_type { };
+
+template <typename T>
+struct has_reset<T, std::void_t<decltype(std::declval<T &>().reset())> >
+  : std::true_type { };
+
+// Where buffers (and zlib, see zoptions) get their memory. Without
+// one they use new and delete.
+class zallocator {
+public:
+
+  virtual ~zallocator() { }
+
+  // n bytes, aligned for anything, throws std::bad_alloc on failure.
+  virtual void * allocate(std::size_t n) = 0;
+  virtual void deallocate(void * p) = 0;
+
+  // for z_stream::zalloc and zfree, opaque is the zallocator.
+  static void * zalloc(void * opaque, unsigned items, unsigned size);
+  static void zfree(void * opaque, void * p);
+
+}; // end of class zallocator
+
+// Statistics, a policy for zstreambuf (and zistream, zostream,
+// ziostream) and for DefaultCompressor and DefaultDecompressor. With
+// nostats, the default, it is all empty inline functions and costs
+// nothing. With zstats they count:
+//
+//   typedef alf::DefaultCompressor<char,std::char_traits<char>,char,
+//                                  std::char_traits<char>,alf::zstats> C;
+//   C c;
+//   alf::zostream<std::ofstream,C,alf::zstats> zs(ofs, c);
+//   ...
+//   zs.stats().print(std::cerr);   // as the streambuf saw it.
+//   c.stats().print(std::cerr);    // deflate itself.
+//
+// BYTES_IN and BYTES_OUT is what went into and came out of the
+// compress/decompress calls, BYTES_READ and BYTES_WRITTEN the
+// compressed data from and to the attached streams. zstreambuf counts
+// chars of the type at hand, the Default ones bytes. Times are the
+// time in compress/decompress (CODEC, for the Default ones the time in
+// zlib), in read_in_ (READ) and write_out_ (WRITE). REALLOCS is how
+// often the streambuf's buffers got new memory.
+//
+// With read ahead the thread does the reading and decompressing, look
+// at the numbers when the stream is idle or done.
+struct zstats_base {
+
+  enum counter {
+    OVERFLOWS, UNDERFLOWS, COMPRESS_CALLS, DECOMPRESS_CALLS, FLUSHES,
+    READS, WRITES, REALLOCS, BYTES_IN, BYTES_OUT, BYTES_READ,
+    BYTES_WRITTEN, NCOUNTERS
+  };
+
+  enum clock { CODEC, READ, WRITE, NCLOCKS };
+
+}; // end of struct zstats_base
+
+class nostats : public zstats_base {
+public:
+
+  void count(counter, unsigned long long = 1) { }
+  // the allocator for buffers that get their memory from a, so that
+  // their reallocations are counted. Here just a.
+  zallocator * counted(zallocator * a) { return a; }
+
+  class timer {
+  public:
+    timer(nostats &, clock) { }
+  };
+
+}; // end of class nostats
+
+class zstats : public zstats_base {
+public:
+
+  typedef std::chrono::steady_clock clock_type;
+
+  zstats() : a_(*this) { clear(); }
+  zstats(const zstats & s) : a_(*this) { *this = s; }
+  // the numbers, counted() stays as it is.
+  zstats & operator = (const zstats & s);
+
+  void count(counter c, unsigned long long n = 1) { c_[c] += n; }
+  zallocator * counted(zallocator * a) { a_.a = a; return & a_; }
+
+  // times a section from construction to destruction.
+  class timer {
+  public:
+    timer(zstats & s, clock k) : s_(s), k_(k), t0_(clock_type::now()) { }
+    ~timer() { s_.t_[k_] += clock_type::now() - t0_; }
+  private:
+    zstats & s_;
+    clock k_;
+    clock_type::time_point t0_;
+  };
+
+  unsigned long long operator [] (counter c) const { return c_[c]; }
+  double seconds(clock k) const
+  { return std::chrono::duration<double>(t_[k]).count(); }
+
+  void clear();
+  zstats & operator += (const zstats & s);
+  std::ostream & print(std::ostream & os) const;
+
+private:
+
+  // counts each allocation as a REALLOCS and passes it on to a, or
+  // new and delete if that is 0.
+  struct counter_ : public zallocator {
+    counter_(zstats & s_) : s(s_), a(0) { }
+    void * allocate(std::size_t n);
+    void deallocate(void * p);
+    zstats & s;
+    zallocator * a;
+  };
+
+  unsigned long long c_[NCOUNTERS];
+  clock_type::duration t_[NCLOCKS];
+  counter_ a_;
+
+}; // end of class zstats
+
+// Keeps the memory it gets back and hands it out again, so opening
+// and closing many streams doesn't go to malloc every time. Blocks
+// are rounded up to a power of two and up to keep blocks of each size
+// are kept. Any thread can use it. It must outlive everything that
+// got memory from it.
+class zpool : public zallocator {
+public:
+
+  zpool(std::size_t keep = 16) : keep_(keep)
+  { for (std::size_t k = 0; k < NSIZES; ++k) free_[k].reserve(keep); }
+  ~zpool() { trim(); }
+
+  void * allocate(std::size_t n);
+  void deallocate(void * p);
+
+  // give all kept blocks back to the system.
+  void trim();
+
+private:
+
+  // sizes 64 bytes and up, the last one is for anything bigger which
+  // isn't kept.
+  enum { MINSHIFT = 6, NSIZES = 26 };
+
+  zpool(const zpool &) = delete;
+  zpool & operator = (const zpool &) = delete;
+
+  std::size_t keep_;
+  std::mutex m_;
+  std::vector<void *> free_[NSIZES];
+
+}; // end of class zpool
+
 // we also need this nifty utility.
 // start with a non-template base class.
 class basic_buffer {
@@ -189,27 +568,66 @@ public:
   std::size_t avail() const { return m_ - n_; }
   std::size_t char_size() const { return s_; }
 
+  // true if the buffer uses memory it doesn't own, see buffer_ref.
+  bool borrowed() const { return ! own_; }
+
+  // 0 means new and delete.
+  zallocator * allocator() const { return a_; }
+
 protected:
 
-  basic_buffer(std::size_t s) : p_(0), s_(s), n_(0), m_(0) { }
+  basic_buffer(std::size_t s)
+    : p_(0), s_(s), n_(0), m_(0), own_(true), a_(0)
+  { }
 
+  // borrow m chars of memory at p, the first n of them are data.
   basic_buffer(void * p, std::size_t s, std::size_t n, std::size_t m)
-    : p_(reinterpret_cast<char *>(p)),  s_(s), n_(n), m_(m)
+    : p_(reinterpret_cast<char *>(p)),  s_(s), n_(n), m_(m), own_(false),
+      a_(0)
   { }
 
-  basic_buffer(basic_buffer && b)
-    : p_(b.p_), s_(b.s_), n_(b.n_), m_(b.m_)
-  { b.p_ = 0; b.n_ = b.m_ = 0; }
+  basic_buffer(basic_buffer && b) noexcept
+    : p_(b.p_), s_(b.s_), n_(b.n_), m_(b.m_), own_(b.own_), a_(b.a_)
+  { b.p_ = 0; b.n_ = b.m_ = 0; b.own_ = true; }
 
-  ~basic_buffer() { delete [] p_; }
+  ~basic_buffer() { if (own_) free_(p_); }
 
   void ensure_(std::size_t n);
   void shrink_(std::size_t n);
+  // get memory from a from now on, what we have is let go.
+  void allocator_(zallocator * a) { shrink_(0); a_ = a; }
+
+  // use the n chars at p as contents, they belong to someone else.
+  void borrow_(const void * p, std::size_t n)
+  {
+    if (own_)
+      free_(p_);
+    p_ = const_cast<char *>(reinterpret_cast<const char *>(p));
+    n_ = m_ = n;
+    own_ = false;
+  }
+
+  void swap_(basic_buffer & b)
+  {
+    std::swap(p_, b.p_);
+    std::swap(n_, b.n_);
+    std::swap(m_, b.m_);
+    std::swap(own_, b.own_);
+    std::swap(a_, b.a_);
+  }
+
+  char * alloc_(std::size_t n)
+  { return a_ != 0 ? static_cast<char *>(a_->allocate(n)) : new char[n]; }
+
+  void free_(char * p)
+  { if (a_ != 0) { if (p != 0) a_->deallocate(p); } else delete [] p; }
 
   char * p_;
   std::size_t s_;
   std::size_t n_;
   std::size_t m_;
+  bool own_; // false if p_ is borrowed and must not be deleted.
+  zallocator * a_; // where the memory comes from, 0 for new/delete.
 
 }; // end of class basic_buffer.
 
@@ -227,9 +645,10 @@ public:
 
   buffer(const buffer & b)
     : basic_buffer(sizeof(char_type))
-  { ensure(b.m_); traits_type::move(p_, b.p_, n_*sizeof(char_type)); }
+  { ensure(b.n_); traits_type::copy(data(), b.data(), b.n_); n_ = b.n_; }
 
-  buffer(buffer && b) : basic_buffer(std::move(b)) { }
+  // noexcept, so that a std::vector of buffers moves them.
+  buffer(buffer && b) noexcept : basic_buffer(std::move(b)) { }
 
   buffer & ensure(std::size_t n)
   { ensure_(n); return *this; }
@@ -237,6 +656,20 @@ public:
   buffer & shrink(std::size_t n)
   { shrink_(n); return *this; }
 
+  // exchange contents with b, no copying.
+  buffer & swap(buffer & b)
+  { swap_(b); return *this; }
+
+  // get memory from a (0 for new/delete), drops what is in the buffer.
+  using basic_buffer::allocator;
+  buffer & allocator(zallocator * a)
+  { allocator_(a); return *this; }
+
+  // make the n chars at p (not ours, not to be written) the contents,
+  // what we had is let go. Growing it makes a copy of our own.
+  buffer & borrow(const char_type * p, std::size_t n)
+  { borrow_(p, n); return *this; }
+
   char_type * data() { return reinterpret_cast<char_type *>(p_); }
 
   const char_type * data() const
@@ -309,7 +742,248 @@ public:
   // a should be a power of 2, so 2, 4, 8, 16, 32, 64, 128, 256, etc is ok.
   buffer & align(std::size_t a, char_type fill = char_type());
 
+protected:
+
+  // used by buffer_ref.
+  buffer(char_type * p, std::size_t n, std::size_t m)
+    : basic_buffer(p, sizeof(char_type), n, m)
+  { }
+
 }; // end of class buffer
+
+// A buffer that refers to memory owned by someone else, zstreambuf
+// uses it to hand the user's memory in xsputn/xsgetn straight to the
+// compressor/decompressor without copying it to a buffer of its own.
+// It works like any other buffer except that if it needs to grow it
+// moves the data to memory of its own, the borrowed memory is never
+// deleted. borrowed() tells you if that has happened.
+template <typename ChT, typename TrT = std::char_traits<ChT> >
+class buffer_ref : public buffer<ChT,TrT> {
+public:
+
+  typedef ChT char_type;
+  typedef TrT traits_type;
+
+  // room for m chars at p, the first n of them are data.
+  buffer_ref(char_type * p, std::size_t n, std::size_t m)
+    : buffer<ChT,TrT>(p, n, m)
+  { }
+
+  // n chars of data at p, to be used as a const buffer only.
+  buffer_ref(const char_type * p, std::size_t n)
+    : buffer<ChT,TrT>(const_cast<char_type *>(p), n, n)
+  { }
+
+}; // end of class buffer_ref
+
+// Checkpoints into a deflate stream for random access, the way zlib's
+// zran example does it. DefaultDecompressor fills it in while it
+// decompresses, one point every span bytes of uncompressed data, and
+// uses it to start decompressing at the point nearest before where
+// you seekg to. save/load keep it in a file next to the compressed
+// one so you don't have to go through all the data again next time.
+//
+// alf::zindex X; // or X(span) for a point every span bytes.
+// D.index(& X);
+// ... read it all from a zistream using D ...
+// X.save("some.file.z.idx");
+//
+// and next time:
+//
+// X.load("some.file.z.idx", size_of_some_file_z);
+// D.index(& X);
+// zs.seekg(some_pos); // only decompresses from the point before some_pos.
+class zindex {
+public:
+
+  enum { WINSIZE = 32768, DEFAULT_SPAN = 1048576 };
+
+  struct point {
+    unsigned long long out; // offset in the uncompressed data.
+    unsigned long long in; // offset of the next whole compressed byte.
+    int bits; // bits of the byte before in that are yet to be used, 0-7.
+    std::size_t wlen; // bytes in window.
+    unsigned char window[WINSIZE]; // the uncompressed data up to out.
+  };
+
+  zindex(unsigned long long span = DEFAULT_SPAN)
+    : span_(span), len_(0), zlen_(0), frame_(-1), complete_(false)
+  { }
+
+  unsigned long long span() const { return span_; }
+  std::size_t size() const { return P.size(); }
+  const point & operator [] (std::size_t i) const { return P[i]; }
+
+  // true when the points cover the whole stream, length() is then
+  // the size of the uncompressed data and zlength() of the compressed.
+  bool complete() const { return complete_; }
+  unsigned long long length() const { return len_; }
+  unsigned long long zlength() const { return zlen_; }
+  void set_complete(unsigned long long len, unsigned long long zlen)
+  { len_ = len; zlen_ = zlen; complete_ = true; }
+
+  // the framing of the data, a zoptions::framing or -1 if not known.
+  // After a seek it tells what comes after the end of the deflate data.
+  int frame() const { return frame_; }
+  void set_frame(int f) { frame_ = f; }
+
+  // the last point at or before out, 0 if none.
+  const point * find(unsigned long long out) const;
+
+  // a new point at the end, the caller fills it in.
+  point & add() { P.push_back(point()); return P.back(); }
+
+  zindex & clear()
+  {
+    P.clear();
+    len_ = zlen_ = 0;
+    frame_ = -1;
+    complete_ = false;
+    return *this;
+  }
+
+  // 0 if ok, -1 on error. zlen is the size of the compressed stream
+  // (for a file of just the stream, the file's size), an index made
+  // for a stream of another size is not loaded. One that isn't
+  // complete only knows that the stream goes on past its last point.
+  int save(const char * fn) const;
+  int load(const char * fn, unsigned long long zlen);
+
+private:
+
+  unsigned long long span_;
+  unsigned long long len_;
+  unsigned long long zlen_;
+  int frame_;
+  bool complete_;
+  std::vector<point> P;
+
+}; // end of class zindex
+
+#ifdef ZSTREAM_WITH_POSIX
+
+// A file mapped into memory to read compressed data from, use it as
+// IST for zistream. zstreambuf sees that it has view() and lets the
+// decompressor read straight from the mapping, no copying into a
+// buffer on the way.
+//
+//   alf::zmapstream ms("foo.z");
+//   alf::DefaultDecompressor<char> D;
+//   alf::zistream<alf::zmapstream,alf::DefaultDecompressor<char> > zs(ms, D);
+//
+// It has the bits of the istream interface zstreambuf uses.
+class zmapstream {
+public:
+
+  typedef char char_type;
+  typedef std::char_traits<char> traits_type;
+
+  zmapstream() : p_(0), n_(0), pos_(0), gcount_(0), open_(false), fail_(true)
+  { }
+  explicit zmapstream(const char * fn)
+    : p_(0), n_(0), pos_(0), gcount_(0), open_(false), fail_(true)
+  { open(fn); }
+  ~zmapstream() { close(); }
+
+  // 0 if ok, -1 if fn can't be opened or mapped.
+  int open(const char * fn);
+  void close();
+  bool is_open() const { return open_; }
+
+  // all of the file.
+  const char_type * data() const { return p_; }
+  std::size_t size() const { return n_; }
+
+  // see has_view.
+  std::streamsize view(const char_type * & p, std::size_t n);
+
+  // what zstreambuf needs from an istream (or you, to read a header).
+  zmapstream & read(char_type * p, std::streamsize n);
+  std::streamsize gcount() const { return gcount_; }
+  std::streamoff tellg() const { return fail_ ? -1 : std::streamoff(pos_); }
+  zmapstream & seekg(std::streamoff off);
+  void clear() { fail_ = ! open_; }
+  explicit operator bool() const { return ! fail_; }
+  bool operator ! () const { return fail_; }
+
+private:
+
+  zmapstream(const zmapstream &) = delete;
+  zmapstream & operator = (const zmapstream &) = delete;
+
+  const char_type * p_;
+  std::size_t n_;
+  std::size_t pos_; // next char to read.
+  std::streamsize gcount_;
+  bool open_;
+  bool fail_; // not open or a read came short.
+
+}; // end of class zmapstream
+
+// A file written with write(2) in big blocks, use it as OST for
+// zostream. Data is collected in a page aligned buffer of bufsz bytes
+// and written when it is full, so all writes but the last are bufsz
+// bytes at a multiple of bufsz in the file. zstreambuf sees that it
+// has reserve() and commit() and lets the compressor write straight
+// into that buffer.
+// The file is done when it is closed or destroyed, after the zostream
+// is closed.
+//
+//   alf::zfdstream fs("foo.z");
+//   alf::DefaultCompressor<char> C;
+//   alf::zostream<alf::zfdstream,alf::DefaultCompressor<char> > zs(fs, C);
+class zfdstream {
+public:
+
+  typedef char char_type;
+  typedef std::char_traits<char> traits_type;
+
+  enum { DEFAULT_BUFSZ = 1048576 };
+
+  zfdstream(std::size_t bufsz = DEFAULT_BUFSZ)
+    : fd_(-1), own_(false), fail_(true), b_(0), n_(0), m_(bufsz)
+  { }
+  explicit zfdstream(const char * fn, std::size_t bufsz = DEFAULT_BUFSZ)
+    : fd_(-1), own_(false), fail_(true), b_(0), n_(0), m_(bufsz)
+  { open(fn); }
+  ~zfdstream() { close(); }
+
+  // create or truncate fn, 0 if ok, -1 if not.
+  int open(const char * fn);
+  // write to a descriptor that is already open, close() leaves it open.
+  int attach(int fd);
+  // write what is left and close, 0 if ok, -1 if something failed.
+  int close();
+  bool is_open() const { return fd_ >= 0; }
+
+  // see has_reserve.
+  char_type * reserve(std::size_t & n);
+  void commit(std::size_t n) { n_ += n; }
+
+  // what zstreambuf needs from an ostream.
+  zfdstream & write(const char_type * p, std::streamsize n);
+  zfdstream & flush();
+  explicit operator bool() const { return ! fail_; }
+  bool operator ! () const { return fail_; }
+
+private:
+
+  zfdstream(const zfdstream &) = delete;
+  zfdstream & operator = (const zfdstream &) = delete;
+
+  int start_();
+  int write_(const char * p, std::size_t n);
+
+  int fd_;
+  bool own_; // we opened fd_ and close it.
+  bool fail_;
+  char * b_; // the buffer, page aligned.
+  std::size_t n_; // bytes in b_.
+  std::size_t m_; // size of b_.
+
+}; // end of class zfdstream
+
+#endif // ZSTREAM_WITH_POSIX
       
 // Note that input stream and output stream must both have same
 // char_type and traits_type.
@@ -327,11 +1001,14 @@ template <typename IST = std::ifstream,
 
 	  typename C__ = DefaultCompressor<typename OST::char_type,
 					   typename OST::traits_type,
-					   char, std::char_traits<char> > >
+					   char, std::char_traits<char> >,
+	  // nostats or zstats, see zstats.
+	  typename S__ = nostats>
 
 class zstreambuf :
     public std::basic_streambuf<typename D__::dout_char_type,
-				typename D__::dout_traits_type> {
+				typename D__::dout_traits_type>,
+    private S__ {
 public:
 
   // restrictions:
@@ -350,6 +1027,7 @@ public:
   typedef OST ostream_type;
   typedef D__ Decompressor;
   typedef C__ Compressor;
+  typedef S__ stats_type;
   typedef typename IST::char_type istream_char_type;
   typedef typename IST::traits_type istream_traits_type;
   typedef typename OST::char_type ostream_char_type;
@@ -362,10 +1040,19 @@ public:
   typedef std::basic_streambuf<typename D__::dout_char_type,
 			       typename D__::dout_traits_type> base_type;
   typedef typename base_type::int_type int_type;
+  typedef typename base_type::pos_type pos_type;
+  typedef typename base_type::off_type off_type;
 
+  // BULKSZ is the largest piece of a bulk write we hand the compressor
+  // at a time, and the default chunk for readahead.
+  // VIEWSZ is how much of an istream with view() zibuf shows at a time.
+  enum { BUFSZ = 4096, BULKSZ = 65536, VIEWSZ = 262144 };
   
   // for decompressing
-  zstreambuf() : zis_(0), zos_(0), D_(0), C_(0) { }
+  zstreambuf()
+    : zis_(0), zos_(0), D_(0), C_(0), zibufpos(0), ipos_(0), zbase_(0),
+      ra_(0), err_(0)
+  { if (stats().counted(0) != 0) allocator(0); }
 
   ~zstreambuf()
   { cleanup(); }
@@ -375,19 +1062,80 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type c);
 
+  // bulk read/write, large requests bypass the get/put area and go
+  // straight between the user's memory and the (de)compressor.
+  virtual std::streamsize xsgetn(char_type * s, std::streamsize n);
+  virtual std::streamsize xsputn(const char_type * s, std::streamsize n);
+
   virtual
   zstreambuf *
   setbuf(char_type *, std::streamsize);
 
+  // positions are in chars of the uncompressed data. Seeking needs a
+  // decompressor with seek() (see the top) and a seekable istream,
+  // tellg works anyway. Not for writing.
+  virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+			   std::ios_base::openmode which
+			   = std::ios_base::in | std::ios_base::out);
+  virtual pos_type seekpos(pos_type pos,
+			   std::ios_base::openmode which
+			   = std::ios_base::in | std::ios_base::out);
+
   Compressor * compressor() { return C_; }
   Decompressor * decompressor() { return D_; }
 
-private:
+  // what the streambuf itself counted, the codecs count their own.
+  stats_type & stats() { return *this; }
+  const stats_type & stats() const { return *this; }
+
+  // get the memory for the buffers from a (0 for new/delete), before
+  // init.
+  void allocator(zallocator * a);
+
+  // Be done with the attached streams - the output is flushed which
+  // ends the compressed stream - and go on with isp and osp. The
+  // compressor and decompressor are reset if they can be (has_reset),
+  // the buffers are kept so nothing new is allocated. Read ahead is
+  // stopped. Returns < 0 if the flush failed.
+  int rebind(istream_type * isp, ostream_type * osp);
+
+  // Read and decompress on a thread of its own, up to depth chunks of
+  // chunk chars ahead of the reader, underflow just takes the next
+  // chunk when it is ready. From then on the thread owns the attached
+  // istream and the decompressor until the zstreambuf goes away.
+  // Returns -1 if not reading or already started.
+  int readahead(std::size_t depth = 4, std::size_t chunk = BULKSZ);
+
+  // A decompressor error ends the data like eof does, after eof this
+  // is what the decompressor returned (< 0), or 0 if it was the real
+  // end. With read ahead it is set on the thread, look at it after eof.
+  int error() const { return err_; }
 
-  enum { BUFSZ = 4096 };
-
-  void cleanup();
+private:
 
+  // the read ahead thread and the ring of chunks it fills.
+  struct readahead_type {
+    std::thread t;
+    std::mutex m;
+    std::condition_variable cv; // ready or stop changed.
+    std::vector<ibuf_type> bufs;
+    std::vector<std::streamsize> lens; // chars in bufs, <= 0 eof/error.
+    std::size_t depth;
+    std::size_t chunk;
+    std::size_t head; // oldest ready chunk, the get area's if held.
+    std::size_t tail; // next chunk for the thread to fill.
+    std::size_t ready; // chunks filled and not yet given back.
+    bool held; // the get area is in bufs[head].
+    bool stop;
+  };
+
+  int cleanup();
+  void readahead_run_();
+  int_type readahead_underflow_();
+
+  int fill_(ibuf_type & b);
+  std::streamsize fill_(char_type * p, std::size_t m);
+  int put_(const char_type * p, std::size_t n, bool flush);
   int read_in_(zibuf_type & b);
   int write_out_(const zobuf_type & b);
 
@@ -399,7 +1147,11 @@ private:
   obuf_type obuf;
   zibuf_type zibuf;
   zobuf_type zobuf;
-  std::size_t zibufpos;
+  std::size_t zibufpos; // how much of zibuf the decompressor has taken.
+  off_type ipos_; // position of egptr() in the uncompressed data.
+  off_type zbase_; // where the compressed data starts in zis_.
+  readahead_type * ra_; // 0 unless readahead() was called.
+  int err_; // first error from the decompressor, 0 if none.
 
 }; // end of class zstreambuf
 
@@ -407,7 +1159,8 @@ private:
 template <typename IST = std::istream,
 	  typename D__ = DefaultDecompressor<typename IST::char_type,
 					     typename IST::traits_type,
-					     char,std::char_traits<char> > >
+					     char,std::char_traits<char> >,
+	  typename S__ = nostats>
 class zistream : public std::basic_istream<typename D__::dout_char_type,
 					   typename D__::dout_traits_type> {
 public:
@@ -422,16 +1175,34 @@ public:
   typedef D__ Decompressor;
   typedef typename IST::char_type istream_char_type;
   typedef typename IST::traits_type istream_traits_type;
-  typedef FailCompressor<istream_char_type, istream_traits_type,
-			 char_type,traits_type> C__;
+  typedef FailCompressor<char_type,traits_type,
+			 istream_char_type, istream_traits_type> C__;
   typedef std::basic_ostream<istream_char_type,istream_traits_type> OST;
   typedef OST ostream_type;
   typedef C__ Compressor;
-  typedef zstreambuf<IST, OST, D__, C__> streambuf;
+  typedef zstreambuf<IST, OST, D__, C__, S__> streambuf;
 
   zistream(istream_type & is, Decompressor & D)
   { this->init(& zbuf_); zbuf_.init(& is, 0, & D, 0); }
 
+  // the buffers get their memory from a.
+  zistream(istream_type & is, Decompressor & D, zallocator * a)
+  { this->init(& zbuf_); zbuf_.allocator(a); zbuf_.init(& is, 0, & D, 0); }
+
+  // read from is from now on, see zstreambuf::rebind.
+  int rebind(istream_type & is)
+  { int r = zbuf_.rebind(& is, 0); this->clear(); return r; }
+
+  // see zstreambuf::readahead.
+  int readahead(std::size_t depth = 4,
+		std::size_t chunk = streambuf::BULKSZ)
+  { return zbuf_.readahead(depth, chunk); }
+
+  // see zstreambuf::error.
+  int error() const { return zbuf_.error(); }
+
+  S__ & stats() { return zbuf_.stats(); }
+
 private:
 
   streambuf zbuf_;
@@ -442,7 +1213,8 @@ private:
 template <typename OST = std::ofstream,
 	  typename C__ = DefaultCompressor<typename OST::char_type,
 					   typename OST::traits_type,
-					   char, std::char_traits<char> > >
+					   char, std::char_traits<char> >,
+	  typename S__ = nostats>
 class zostream : public std::basic_ostream<typename C__::cin_char_type,
 					   typename C__::cin_traits_type> {
 public:
@@ -462,11 +1234,22 @@ public:
   typedef std::basic_istream<ostream_char_type,ostream_traits_type> IST;
   typedef IST istream_type;
   typedef D__ Decompressor;
-  typedef zstreambuf<IST, OST, D__, C__> streambuf;
+  typedef zstreambuf<IST, OST, D__, C__, S__> streambuf;
 
   zostream(OST & os, Compressor & C)
   { this->init(& zbuf_); zbuf_.init(0, & os, 0, & C); }
 
+  // the buffers get their memory from a.
+  zostream(OST & os, Compressor & C, zallocator * a)
+  { this->init(& zbuf_); zbuf_.allocator(a); zbuf_.init(0, & os, 0, & C); }
+
+  // finish the compressed stream and write to os from now on, see
+  // zstreambuf::rebind.
+  int rebind(OST & os)
+  { int r = zbuf_.rebind(0, & os); this->clear(); return r; }
+
+  S__ & stats() { return zbuf_.stats(); }
+
 private:
 
   streambuf zbuf_;
@@ -483,7 +1266,8 @@ template <typename IST = std::ifstream,
 
 	  typename C__ = DefaultCompressor<typename OST::char_type,
 					   typename OST::traits_type,
-					   char, std::char_traits<char> > >
+					   char, std::char_traits<char> >,
+	  typename S__ = nostats>
 
 class ziostream : public std::basic_iostream<typename D__::out_char_type,
 					     typename D__::out_traits_type> {
@@ -503,12 +1287,14 @@ public:
   typedef typename IST::traits_type istream_traits_type;
   typedef typename OST::char_type ostream_char_type;
   typedef typename OST::traits_type ostream_traits_type;
-  typedef zstreambuf<IST, OST, D__, C__> streambuf;
+  typedef zstreambuf<IST, OST, D__, C__, S__> streambuf;
 
   ziostream(IST & is, Decompressor & D,
 	    OST & os, Compressor & C)
   { this->init(& zbuf_); zbuf_.init(& is, & os, & D, & C); }
 
+  S__ & stats() { return zbuf_.stats(); }
+
 private:
 
   streambuf zbuf_;
@@ -516,12 +1302,148 @@ private:
 }; // end of class ziostream
 
 
+// How DefaultCompressor and DefaultDecompressor set up zlib, see
+// deflateInit2 and inflateInit2 in zlib.h for the details.
+//
+//   DefaultCompressor<char> C(zoptions(zoptions::GZIP, 6).strategy(Z_RLE));
+//
+// Framing is the header and trailer around the deflate data: ZLIB
+// (RFC 1950), GZIP (RFC 1952) or RAW for none at all. AUTO is for
+// decompressing only, it takes zlib or gzip and finds out which from
+// the header, a compressor treats it as ZLIB.
+struct zoptions {
+
+  enum framing { ZLIB, GZIP, RAW, AUTO };
+
+  framing frame_;
+  int level_; // 0 - 9 or Z_DEFAULT_COMPRESSION, compress only.
+  int strategy_; // Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE... compress only.
+  int wbits_; // log2 of window size, 8 - 15.
+  int memlevel_; // 1 - 9, memory for compression state.
+  std::size_t chunk_; // room (in chars) the buffer versions get at least.
+  zallocator * alloc_; // memory for zlib, 0 for its own (malloc).
+
+  zoptions(framing f = ZLIB, int l = 9)
+    : frame_(f), level_(l), strategy_(Z_DEFAULT_STRATEGY),
+      wbits_(MAX_WBITS), memlevel_(8), chunk_(8192), alloc_(0)
+  { }
+
+  zoptions & frame(framing f) { frame_ = f; return *this; }
+  zoptions & level(int l) { level_ = l; return *this; }
+  zoptions & strategy(int s) { strategy_ = s; return *this; }
+  zoptions & wbits(int w) { wbits_ = w; return *this; }
+  zoptions & memlevel(int m) { memlevel_ = m; return *this; }
+  zoptions & chunk(std::size_t n) { chunk_ = n != 0 ? n : 1; return *this; }
+  zoptions & allocator(zallocator * a) { alloc_ = a; return *this; }
+
+  framing frame() const { return frame_; }
+  int level() const { return level_; }
+  int strategy() const { return strategy_; }
+  int wbits() const { return wbits_; }
+  int memlevel() const { return memlevel_; }
+  std::size_t chunk() const { return chunk_; }
+  zallocator * allocator() const { return alloc_; }
+
+  // windowBits argument for deflateInit2/inflateInit2.
+  int zlib_wbits(bool inflating) const
+  {
+    switch (frame_) {
+    case GZIP: return wbits_ + 16;
+    case RAW: return -wbits_;
+    case AUTO: return inflating ? wbits_ + 32 : wbits_;
+    default: return wbits_;
+    }
+  }
+
+}; // end of struct zoptions
+
+// The buffer versions of compress and decompress for a codec that has
+// the span versions, d gets at least chunk chars of room at a time.
+template <typename C>
+int zcompress_buffer(C & c, typename C::cout_buf_type & d,
+		     const typename C::cin_buf_type & s, bool flush,
+		     std::size_t chunk);
+
+template <typename D>
+int zdecompress_buffer(D & dc, typename D::dout_buf_type & d,
+		       const typename D::din_buf_type & s, bool flush,
+		       std::size_t chunk);
+
+// The zresult bookkeeping for codecs that work on bytes, like zlib,
+// zstd and lz4. A char of in or out may be split between two calls,
+// zbytes keeps track of the bytes of in already taken and of the start
+// of a char for out that is written first next time.
+//
+//   zbytes<char,wchar_t> B;
+//   const unsigned char * ip; unsigned char * op;
+//   std::size_t ilen, olen;
+//   B.begin(in, out, ip, ilen, op, olen); // out.len() must be > 0.
+//   ... codec takes k_in bytes from ip and writes k_out bytes to op ...
+//   zresult res = B.done(k_in, k_out, flush_and_nothing_left_in_codec);
+template <typename InCh, typename OutCh>
+class zbytes {
+public:
+
+  zbytes() : skip(0), npart(0), ip0(0), op0(0) { }
+
+  void begin(span<const InCh> in, span<OutCh> out,
+	     const unsigned char * & ip, std::size_t & ilen,
+	     unsigned char * & op, std::size_t & olen)
+  {
+    ip0 = reinterpret_cast<const unsigned char *>(in.data());
+    ilen = in.len() * sizeof(InCh);
+    if (skip > ilen) skip = 0;
+    ip = ip0 + skip;
+    ilen -= skip;
+    op0 = reinterpret_cast<unsigned char *>(out.data());
+    std::memcpy(op0, part, npart);
+    op = op0 + npart;
+    olen = out.len() * sizeof(OutCh) - npart;
+  }
+
+  // pad fills up a split char at the end of out, for the last output.
+  zresult done(std::size_t k_in, std::size_t k_out, bool pad)
+  {
+    zresult res;
+    k_in += skip;
+    res.consumed = k_in / sizeof(InCh);
+    skip = k_in - res.consumed * sizeof(InCh);
+    k_out += npart;
+    res.produced = k_out / sizeof(OutCh);
+    npart = k_out - res.produced * sizeof(OutCh);
+    std::memcpy(part, op0 + res.produced * sizeof(OutCh), npart);
+    // a split char always has the rest of its room in out.
+    if (pad && npart != 0) {
+      std::memset(op0 + k_out, 0, sizeof(OutCh) - npart);
+      ++res.produced;
+      npart = 0;
+    }
+    res.ret = 0;
+    return res;
+  }
+
+  // all of in is taken, for what comes after the end of the data.
+  void take_all(zresult & res, std::size_t n) { res.consumed = n; skip = 0; }
+
+  void clear() { skip = npart = 0; }
+
+private:
+
+  std::size_t skip; // bytes of the first char of in already taken.
+  std::size_t npart; // bytes in part.
+  unsigned char part[sizeof(OutCh)]; // start of a char for out.
+  const unsigned char * ip0;
+  unsigned char * op0;
+
+}; // end of class zbytes
+
 // some compressors and decompressors
 template <typename IChT,
 	  typename ITrT /* = std::char_traits<IChT> */,
 	  typename OChT /* = char */,
-	  typename OTrT /* = std::char_traits<OChT> */ >
-class DefaultCompressor {
+	  typename OTrT /* = std::char_traits<OChT> */,
+	  typename S /* = nostats */ >
+class DefaultCompressor : private S {
 public:
 
   typedef IChT cin_char_type;
@@ -531,28 +1453,41 @@ public:
   typedef buffer<cout_char_type,cout_traits_type> cout_buf_type;
   typedef buffer<cin_char_type,cin_traits_type> cin_buf_type;
 
-  DefaultCompressor();
-  int compress(cout_buf_type & d, const cin_buf_type & s, bool flush=false);
+  // flush ends the compressed stream (Z_FINISH), what comes after
+  // starts a new one.
+  DefaultCompressor(const zoptions & opt = zoptions());
+  ~DefaultCompressor() { deflateEnd(&Z); }
+  int compress(cout_buf_type & d, const cin_buf_type & s, bool flush=false)
+  { return zcompress_buffer(*this, d, s, flush, O.chunk()); }
+  zresult compress(span<const cin_char_type> in, span<cout_char_type> out,
+		   bool flush=false);
+  // forget the stream so far and start a new one.
   DefaultCompressor & reset();
   int zlibret() const { return ret; }
   const char * msg() const { return Z.msg; }
+  const zoptions & options() const { return O; }
+  // deflate calls, bytes and the time in deflate (CODEC).
+  S & stats() { return *this; }
 
 private:
 
-  typedef buffer<char,std::char_traits<char> > char_buf_type;
+  DefaultCompressor(const DefaultCompressor &) = delete;
+  DefaultCompressor & operator = (const DefaultCompressor &) = delete;
 
+  zoptions O;
   z_stream Z;
-  char_buf_type U; // our private compress src buffer - uncompressed data.
-  char_buf_type C; // our private compress dst buffer - compressed data.
   int ret; // return code from last zlib call.
+  // zlib works on bytes, a char may be split between two calls.
+  zbytes<cin_char_type,cout_char_type> B;
 
 }; // end of class DefaultCompressor
 
 template <typename OChT,
 	  typename OTrT /* = std::char_traits<OChT> */,
 	  typename IChT /* = char */,
-	  typename ITrT /* = std::char_traits<IChT> */ >
-class DefaultDecompressor {
+	  typename ITrT /* = std::char_traits<IChT> */,
+	  typename S /* = nostats */ >
+class DefaultDecompressor : private S {
 public:
 
   typedef OChT dout_char_type;
@@ -562,19 +1497,51 @@ public:
   typedef buffer<dout_char_type,dout_traits_type> dout_buf_type;
   typedef buffer<din_char_type,din_traits_type> din_buf_type;
 
-  DefaultDecompressor();
-  int decompress(dout_buf_type & d, const din_buf_type & s, bool flush=false);
+  // by default zlib or gzip, whichever the data is. Gzip data may
+  // have several members one after the other (cat a.gz b.gz), they
+  // are read as one. Anything after the end of zlib or raw data, or
+  // after the last gzip member, is ignored.
+  DefaultDecompressor(const zoptions & opt = zoptions(zoptions::AUTO));
+  ~DefaultDecompressor() { inflateEnd(&Z); }
+  int decompress(dout_buf_type & d, const din_buf_type & s, bool flush=false)
+  { return zdecompress_buffer(*this, d, s, flush, O.chunk()); }
+  zresult decompress(span<const din_char_type> in, span<dout_char_type> out,
+		     bool flush=false);
+  // forget the stream so far and start a new one, the index is dropped.
+  DefaultDecompressor & reset();
   int zlibret() const { return ret; }
   const char * msg() const { return Z.msg; }
+  const zoptions & options() const { return O; }
+  // inflate calls, bytes and the time in inflate (CODEC).
+  S & stats() { return *this; }
+
+  // use X for random access and add points to it as we go, 0 for none.
+  DefaultDecompressor & index(zindex * X_) { X = X_; return *this; }
+  zindex * index() const { return X; }
+
+  // see the Decompressor contract at the top.
+  long long seek(unsigned long long off);
 
 private:
 
-  typedef buffer<char,std::char_traits<char> > char_buf_type;
+  DefaultDecompressor(const DefaultDecompressor &) = delete;
+  DefaultDecompressor & operator = (const DefaultDecompressor &) = delete;
 
+  zoptions O;
   z_stream Z;
-  char_buf_type C; // our private decompress src buffer - compressed data.
-  char_buf_type U; // our private decompress dst buffer - uncompressed data.
   int ret; // return code from last zlib call.
+  // zlib works on bytes, a char may be split between two calls.
+  zbytes<din_char_type,dout_char_type> B;
+  // for random access.
+  zindex * X;
+  unsigned long long inpos; // bytes of compressed data taken so far.
+  unsigned long long outpos; // bytes of uncompressed data made so far.
+  unsigned long long discard; // bytes to throw away after a seek.
+  int prime; // bits to take from the first byte after a seek.
+  zoptions::framing wrap; // what the data is, AUTO until we know.
+  bool raw; // zlib is raw after a seek, the trailer is for us to skip.
+  bool between; // a gzip member ended, another may follow.
+  unsigned tail; // trailer bytes left to skip.
 
 }; // end of class DefaultDecompressor
 
@@ -662,6 +1629,356 @@ public:
 
 }; // end of class FailDecompressor
 
+// The byte level work of ParallelCompressor, like pigz it splits the
+// input into blocks of blocksz bytes and deflates them on a pool of
+// threads. Each block uses the last 32K of the block before as
+// dictionary and ends on a byte boundary (Z_SYNC_FLUSH), so the blocks
+// put together in order make up one ordinary zlib, gzip or raw stream,
+// whatever the zoptions say (AUTO is zlib).
+class basic_parallel_compressor {
+public:
+
+  enum { DEFAULT_BLOCKSZ = 131072, DICTSZ = 32768 };
+
+  unsigned threads() const { return nthreads_; }
+  std::size_t block_size() const { return blocksz_; }
+  int zlibret() const { return ret_; }
+  const zoptions & options() const { return opt_; }
+
+protected:
+
+  // threads == 0 means one per cpu.
+  basic_parallel_compressor(unsigned threads, std::size_t blocksz,
+			    const zoptions & opt);
+  ~basic_parallel_compressor();
+
+  // compress the n bytes at p and append what is ready to O.
+  // flush ends the zlib stream, anything after that starts a new one.
+  int compress_(const char * p, std::size_t n, bool flush);
+
+  typedef buffer<char,std::char_traits<char> > char_buf_type;
+
+  char_buf_type O; // compressed bytes ready to go out.
+
+private:
+
+  struct job {
+    char_buf_type dict; // last DICTSZ bytes of the block before.
+    char_buf_type in;
+    char_buf_type out;
+    unsigned long check; // adler32 or crc32 of in.
+    bool last;
+    bool done;
+    int ret;
+  };
+
+  basic_parallel_compressor(const basic_parallel_compressor &) = delete;
+  basic_parallel_compressor &
+  operator = (const basic_parallel_compressor &) = delete;
+
+  void worker_();
+  void submit_(bool last);
+  int collect_(bool wait_all);
+  void header_();
+  void trailer_();
+
+  unsigned nthreads_;
+  std::size_t blocksz_;
+  std::size_t maxjobs_; // blocks in the air before we wait for one.
+  zoptions opt_;
+  zoptions::framing frame_; // ZLIB, GZIP or RAW.
+  int ret_; // first error from zlib, Z_OK if none.
+  bool started_; // header written for the current stream.
+  unsigned long check_; // adler32 or crc32 of the current stream so far.
+  unsigned long len_; // bytes of the current stream so far, mod 2^32.
+  char_buf_type cur_; // block being filled.
+  char_buf_type dict_; // dictionary for the next block.
+  std::vector<std::thread> pool_;
+  std::mutex m_;
+  std::condition_variable work_; // todo_ has a job or stop_ is set.
+  std::condition_variable done_; // a job is done.
+  std::deque<job *> jobs_; // submitted and not yet collected, in order.
+  std::deque<job *> todo_; // not yet picked up by a worker.
+  std::vector<job *> free_; // collected jobs to reuse.
+  bool stop_;
+
+}; // end of class basic_parallel_compressor
+
+template <typename IChT,
+	  typename ITrT /* = std::char_traits<IChT> */,
+	  typename OChT /* = char */,
+	  typename OTrT /* = std::char_traits<OChT> */ >
+class ParallelCompressor : public basic_parallel_compressor {
+public:
+
+  typedef IChT cin_char_type;
+  typedef ITrT cin_traits_type;
+  typedef OChT cout_char_type;
+  typedef OTrT cout_traits_type;
+  typedef buffer<cout_char_type,cout_traits_type> cout_buf_type;
+  typedef buffer<cin_char_type,cin_traits_type> cin_buf_type;
+
+  // opt gives the framing, level, strategy, window, memLevel and the
+  // allocator for zlib, like for DefaultCompressor.
+  ParallelCompressor(unsigned threads = 0,
+		     std::size_t blocksz = DEFAULT_BLOCKSZ,
+		     const zoptions & opt = zoptions())
+    : basic_parallel_compressor(threads, blocksz, opt)
+  { }
+  // zlib at the given level.
+  ParallelCompressor(unsigned threads, std::size_t blocksz, int level)
+    : basic_parallel_compressor(threads, blocksz,
+				zoptions(zoptions::ZLIB, level))
+  { }
+
+  // flush (or an empty s) ends the stream.
+  int compress(cout_buf_type & d, const cin_buf_type & s, bool flush=false);
+
+}; // end of class ParallelCompressor
+
+#ifdef ZSTREAM_WITH_ZSTD
+
+// zstd (RFC 8878) frames. flush ends the frame, what comes after
+// starts a new one. The decompressor reads any number of frames one
+// after the other.
+template <typename IChT,
+	  typename ITrT /* = std::char_traits<IChT> */,
+	  typename OChT /* = char */,
+	  typename OTrT /* = std::char_traits<OChT> */ >
+class ZstdCompressor {
+public:
+
+  typedef IChT cin_char_type;
+  typedef ITrT cin_traits_type;
+  typedef OChT cout_char_type;
+  typedef OTrT cout_traits_type;
+  typedef buffer<cout_char_type,cout_traits_type> cout_buf_type;
+  typedef buffer<cin_char_type,cin_traits_type> cin_buf_type;
+
+  // level 1 - ZSTD_maxCLevel(), or negative for faster still.
+  ZstdCompressor(int level = ZSTD_CLEVEL_DEFAULT, std::size_t chunk = 8192);
+  ~ZstdCompressor() { ZSTD_freeCCtx(Z); }
+  int compress(cout_buf_type & d, const cin_buf_type & s, bool flush=false)
+  { return zcompress_buffer(*this, d, s, flush, chunk_); }
+  zresult compress(span<const cin_char_type> in, span<cout_char_type> out,
+		   bool flush=false);
+  // forget the frame so far and start a new one.
+  ZstdCompressor & reset();
+  std::size_t zstdret() const { return ret; }
+  const char * msg() const { return ZSTD_getErrorName(ret); }
+
+private:
+
+  ZstdCompressor(const ZstdCompressor &) = delete;
+  ZstdCompressor & operator = (const ZstdCompressor &) = delete;
+
+  ZSTD_CCtx * Z;
+  std::size_t ret; // return code from last zstd call.
+  std::size_t chunk_;
+  zbytes<cin_char_type,cout_char_type> B;
+
+}; // end of class ZstdCompressor
+
+template <typename OChT,
+	  typename OTrT /* = std::char_traits<OChT> */,
+	  typename IChT /* = char */,
+	  typename ITrT /* = std::char_traits<IChT> */ >
+class ZstdDecompressor {
+public:
+
+  typedef OChT dout_char_type;
+  typedef OTrT dout_traits_type;
+  typedef IChT din_char_type;
+  typedef ITrT din_traits_type;
+  typedef buffer<dout_char_type,dout_traits_type> dout_buf_type;
+  typedef buffer<din_char_type,din_traits_type> din_buf_type;
+
+  ZstdDecompressor(std::size_t chunk = 8192);
+  ~ZstdDecompressor() { ZSTD_freeDCtx(Z); }
+  int decompress(dout_buf_type & d, const din_buf_type & s, bool flush=false)
+  { return zdecompress_buffer(*this, d, s, flush, chunk_); }
+  zresult decompress(span<const din_char_type> in, span<dout_char_type> out,
+		     bool flush=false);
+  // forget the frame so far, what comes next is a new one.
+  ZstdDecompressor & reset();
+  std::size_t zstdret() const { return ret; }
+  const char * msg() const
+  { return ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "truncated frame"; }
+
+private:
+
+  ZstdDecompressor(const ZstdDecompressor &) = delete;
+  ZstdDecompressor & operator = (const ZstdDecompressor &) = delete;
+
+  ZSTD_DCtx * Z;
+  std::size_t ret; // return code from last zstd call, 0 between frames.
+  std::size_t chunk_;
+  zbytes<din_char_type,dout_char_type> B;
+
+}; // end of class ZstdDecompressor
+
+#endif // ZSTREAM_WITH_ZSTD
+
+#ifdef ZSTREAM_WITH_LZ4
+
+// lz4 frames, with content checksum. flush ends the frame, what comes
+// after starts a new one. The decompressor reads any number of frames
+// one after the other.
+template <typename IChT,
+	  typename ITrT /* = std::char_traits<IChT> */,
+	  typename OChT /* = char */,
+	  typename OTrT /* = std::char_traits<OChT> */ >
+class Lz4Compressor {
+public:
+
+  typedef IChT cin_char_type;
+  typedef ITrT cin_traits_type;
+  typedef OChT cout_char_type;
+  typedef OTrT cout_traits_type;
+  typedef buffer<cout_char_type,cout_traits_type> cout_buf_type;
+  typedef buffer<cin_char_type,cin_traits_type> cin_buf_type;
+
+  // level 0 is the fast one, 3 and up use lz4hc.
+  Lz4Compressor(int level = 0, std::size_t chunk = 8192);
+  ~Lz4Compressor() { LZ4F_freeCompressionContext(Z); }
+  int compress(cout_buf_type & d, const cin_buf_type & s, bool flush=false)
+  { return zcompress_buffer(*this, d, s, flush, chunk_); }
+  zresult compress(span<const cin_char_type> in, span<cout_char_type> out,
+		   bool flush=false);
+  // forget the frame so far and start a new one.
+  Lz4Compressor & reset();
+  std::size_t lz4ret() const { return ret; }
+  const char * msg() const { return LZ4F_getErrorName(ret); }
+
+private:
+
+  enum { BLOCKSZ = 65536 }; // bytes given to lz4 at a time.
+
+  Lz4Compressor(const Lz4Compressor &) = delete;
+  Lz4Compressor & operator = (const Lz4Compressor &) = delete;
+
+  typedef buffer<char,std::char_traits<char> > char_buf_type;
+
+  LZ4F_cctx * Z;
+  LZ4F_preferences_t P;
+  std::size_t ret; // return code from last lz4 call.
+  std::size_t chunk_;
+  // lz4 wants room for the worst case, it writes to S and we copy
+  // from there to out as room allows.
+  char_buf_type S;
+  std::size_t spos; // bytes of S already given out.
+  bool begun; // frame header written.
+  bool ended; // frame end is in S.
+  zbytes<cin_char_type,cout_char_type> B;
+
+}; // end of class Lz4Compressor
+
+template <typename OChT,
+	  typename OTrT /* = std::char_traits<OChT> */,
+	  typename IChT /* = char */,
+	  typename ITrT /* = std::char_traits<IChT> */ >
+class Lz4Decompressor {
+public:
+
+  typedef OChT dout_char_type;
+  typedef OTrT dout_traits_type;
+  typedef IChT din_char_type;
+  typedef ITrT din_traits_type;
+  typedef buffer<dout_char_type,dout_traits_type> dout_buf_type;
+  typedef buffer<din_char_type,din_traits_type> din_buf_type;
+
+  Lz4Decompressor(std::size_t chunk = 8192);
+  ~Lz4Decompressor() { LZ4F_freeDecompressionContext(Z); }
+  int decompress(dout_buf_type & d, const din_buf_type & s, bool flush=false)
+  { return zdecompress_buffer(*this, d, s, flush, chunk_); }
+  zresult decompress(span<const din_char_type> in, span<dout_char_type> out,
+		     bool flush=false);
+  // forget the frame so far, what comes next is a new one.
+  Lz4Decompressor & reset();
+  std::size_t lz4ret() const { return ret; }
+  const char * msg() const
+  { return LZ4F_isError(ret) ? LZ4F_getErrorName(ret) : "truncated frame"; }
+
+private:
+
+  Lz4Decompressor(const Lz4Decompressor &) = delete;
+  Lz4Decompressor & operator = (const Lz4Decompressor &) = delete;
+
+  LZ4F_dctx * Z;
+  std::size_t ret; // return code from last lz4 call, 0 between frames.
+  std::size_t chunk_;
+  zbytes<din_char_type,dout_char_type> B;
+
+}; // end of class Lz4Decompressor
+
+#endif // ZSTREAM_WITH_LZ4
+
+// Reads zlib, gzip and - if built with them - zstd and lz4, it looks
+// at the first bytes of the data to see which it is.
+template <typename OChT,
+	  typename OTrT /* = std::char_traits<OChT> */,
+	  typename IChT /* = char */,
+	  typename ITrT /* = std::char_traits<IChT> */ >
+class AutoDecompressor {
+public:
+
+  typedef OChT dout_char_type;
+  typedef OTrT dout_traits_type;
+  typedef IChT din_char_type;
+  typedef ITrT din_traits_type;
+  typedef buffer<dout_char_type,dout_traits_type> dout_buf_type;
+  typedef buffer<din_char_type,din_traits_type> din_buf_type;
+
+  enum format { UNKNOWN, ZLIB, GZIP, ZSTD, LZ4 };
+
+  // opt is for zlib and gzip, only its chunk is used for the others.
+  AutoDecompressor(const zoptions & opt = zoptions(zoptions::AUTO))
+    : O(opt), F(UNKNOWN), nhead(0), hpos(0), Z_(0)
+#ifdef ZSTREAM_WITH_ZSTD
+    , S_(0)
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+    , L_(0)
+#endif
+  { }
+  ~AutoDecompressor();
+  int decompress(dout_buf_type & d, const din_buf_type & s, bool flush=false)
+  { return zdecompress_buffer(*this, d, s, flush, O.chunk()); }
+  zresult decompress(span<const din_char_type> in, span<dout_char_type> out,
+		     bool flush=false);
+  // forget the data so far, the next data may be of another format.
+  AutoDecompressor & reset();
+  // what the data turned out to be, UNKNOWN before the first bytes.
+  format type() const { return F; }
+  const char * msg() const;
+
+private:
+
+  // enough chars for 4 bytes of magic.
+  enum { HEADLEN = (4 + sizeof(din_char_type) - 1) / sizeof(din_char_type) };
+
+  AutoDecompressor(const AutoDecompressor &) = delete;
+  AutoDecompressor & operator = (const AutoDecompressor &) = delete;
+
+  int start_();
+  zresult inner_(span<const din_char_type> in, span<dout_char_type> out,
+		 bool flush);
+
+  zoptions O;
+  format F;
+  din_char_type head[HEADLEN]; // the first chars of the data.
+  std::size_t nhead; // chars in head.
+  std::size_t hpos; // chars of head given to the decompressor.
+  DefaultDecompressor<OChT,OTrT,IChT,ITrT> * Z_;
+#ifdef ZSTREAM_WITH_ZSTD
+  ZstdDecompressor<OChT,OTrT,IChT,ITrT> * S_;
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  Lz4Decompressor<OChT,OTrT,IChT,ITrT> * L_;
+#endif
+
+}; // end of class AutoDecompressor
+
 // ziomanip stuff
 
 // some predeclarations
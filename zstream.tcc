@@ -2,9 +2,10 @@
 
 // included by zstream.hxx
 
-template <typename IST, typename OST, typename D__, typename C__>
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
 void
-alf::zstreambuf<IST,OST,D__,C__>::init(istream_type * isp,
+alf::zstreambuf<IST,OST,D__,C__,S__>::init(istream_type * isp,
 				       ostream_type * osp,
 				       D__ * d, C__ * c)
 {
@@ -17,9 +18,12 @@ alf::zstreambuf<IST,OST,D__,C__>::init(istream_type * isp,
       // something is wrong.
       throw "zis_ is non-zero while D_ is 0";
     
-    // set up initial get area.
+    // set up initial get area, empty.
     char_type * g = ibuf.get(BUFSZ);
-    this->setg(g, g + BUFSZ, g + BUFSZ);
+    this->setg(g, g, g);
+    // seekg needs to know where the compressed data starts.
+    std::streamoff z = zis_->tellg();
+    zbase_ = z < 0 ? 0 : z;
   }
   if (zos_ != 0) {
     if (c == 0)
@@ -31,66 +35,58 @@ alf::zstreambuf<IST,OST,D__,C__>::init(istream_type * isp,
   }
 }
 
-template <typename IST, typename OST, typename D__, typename C__>
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
 // virtual
-typename alf::zstreambuf<IST,OST,D__,C__>::int_type
-alf::zstreambuf<IST,OST,D__,C__>::underflow()
+typename alf::zstreambuf<IST,OST,D__,C__,S__>::int_type
+alf::zstreambuf<IST,OST,D__,C__,S__>::underflow()
 {
   // get area:
   // eback() -- start of get area.
   // gptr() -- pointer to current char.
   // egptr() -- pointer to end of get area.
 
+  stats().count(S__::UNDERFLOWS);
   // if data left in buffer, return it.
   if (this->gptr() && this->gptr() < this->egptr())
     return traits_type::to_int_type(*this->gptr());
   // if not reading return eof.
   if (zis_ == 0)
     return traits_type::eof();
-  // do we have any data in compressed buffer?
-  std::size_t n = 0;
-  bool is_eof = false;
-  if (zibuf.len() > 0 && zibufpos > 0 && zibufpos < zibuf.len()) {
-    // move left over data to beginning of buffer.
-    n = zibuf.len() - zibufpos;
-    traits_type::move(zibuf.data(), zibuf.data() + zibufpos, n);
-    zibuf.force_len(n);
+  if (ra_ != 0)
+    return readahead_underflow_();
+  // everything in ibuf has been handed out, start over.
+  ibuf.clear();
+  std::streamsize k;
+  char_type * ibufp;
+  if constexpr (has_span_decompress<D__>::value) {
+    // decompress straight into ibuf.
+    ibufp = ibuf.get(BUFSZ);
+    k = fill_(ibufp, BUFSZ);
+    if (k > 0)
+      ibuf.inclen(k);
+  } else {
+    k = fill_(ibuf);
+    // decompress may have moved the buffer.
+    ibufp = ibuf.data();
   }
-  zibufpos = 0;
-  // read in more data from source.
-  std::size_t zibufpos_ = zibuf.len();
-  int k = read_in_(zibuf);
-  if (k < 0)
-    return traits_type::eof();
-  char_type * ibuf_save = ibuf.data();
-
-  k = D_->decompress(ibuf, zibuf, zibuf.avail() > 0);
-
-  char_type * ibufp = ibuf.data();
-  if (ibufp != ibuf_save)
-    // decompress expanded the buffer.
-    this->setg(ibufp, ibufp, ibufp);
-
-  if (this->gptr() == 0 && ibufp != 0)
-    this->setg(ibufp, ibufp, ibufp);
-
-  zibufpos = zibufpos_;
-
-  if (k < 0)
-    return traits_type::eof();
-
   this->setg(ibufp, ibufp, ibufp + ibuf.len());
-
+  ipos_ += ibuf.len();
+  if (k <= 0)
+    return traits_type::eof();
   return traits_type::to_int_type(*this->gptr());
 }
 
-template <typename IST, typename OST, typename D__, typename C__>
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
 // virtual
-typename alf::zstreambuf<IST,OST,D__,C__>::int_type
-alf::zstreambuf<IST,OST,D__,C__>::overflow(int_type c)
+typename alf::zstreambuf<IST,OST,D__,C__,S__>::int_type
+alf::zstreambuf<IST,OST,D__,C__,S__>::overflow(int_type c)
 {
-  int k = 0;
+  if (zos_ == 0)
+    return traits_type::eof();
 
+  stats().count(S__::OVERFLOWS);
   bool is_eof = traits_type::eq_int_type(c, traits_type::eof());
   if (this->pbase()) {
     if (this->pptr() > this->epptr() || this->pptr() < this->pbase())
@@ -105,75 +101,542 @@ alf::zstreambuf<IST,OST,D__,C__>::overflow(int_type c)
 	(this->epptr() > obuf.real_endp()) ||
 	(this->epptr() < this->pptr()))
       return traits_type::eof();
-    int n = this->pptr() - this->pbase(); // should be the same as obuf.len().
-    obuf.force_len(n);
-
-    // add extra char to buffer if not eof.
-    if (! is_eof) {
-      char_type * obufp = obuf.get(2);
-      *obufp = traits_type::to_char_type(c);
-      obuf.inclen(1);
-      this->pbump(1);
-      ++n;
-    }
-    if (zos_ == 0)
-      return traits_type::eof();
-    k = C_->compress(zobuf, obuf, is_eof);
-    std::size_t olen = obuf.len();
-    if (olen < 4096)
-      obuf.ensure(olen = 4096);
-    char_type * obufp = obuf.data();
-    this->setp(obufp, obufp + olen);
-  } else {
-    if (zos_ == 0)
-      return traits_type::eof();
-    if (! is_eof) {
-      char_type * obufp2 = obuf.get(1);
-      *obufp2 = traits_type::to_char_type(c);
-      obuf.inclen(1);
-    }
-    // do we need space for compressed data?
-    k = C_->compress(zobuf, obuf, is_eof);
+    obuf.force_len(this->pptr() - this->pbase());
+  }
+  // add extra char to buffer if not eof.
+  if (! is_eof) {
+    char_type * obufp = obuf.get(1);
+    *obufp = traits_type::to_char_type(c);
+    obuf.inclen(1);
   }
+  int k = put_(obuf.data(), obuf.len(), is_eof);
+  // the compressor has taken it all, start with an empty put area.
+  obuf.clear();
+  char_type * obufp = obuf.get(BUFSZ);
+  this->setp(obufp, obufp + BUFSZ);
   if (k < 0)
     return traits_type::eof();
-  // write output
-  std::size_t zlen = zobuf.len();
-  if (zlen > 0) {
-    int u = write_out_(zobuf);
-    if (u != zlen)
-      return traits_type::eof();
-    zobuf.clear();
-  }
   return is_eof ? traits_type::not_eof(c) : c;
 }
 
-template <typename IST, typename OST, typename D__, typename C__>
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+// virtual
+std::streamsize
+alf::zstreambuf<IST,OST,D__,C__,S__>::xsgetn(char_type * s, std::streamsize n)
+{
+  std::streamsize got = 0;
+  // first hand out what is left in the get area.
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > 0) {
+    if (k > n) k = n;
+    traits_type::copy(s, this->gptr(), k);
+    this->setg(this->eback(), this->gptr() + k, this->egptr());
+    got = k;
+  }
+  if (zis_ == 0)
+    return got;
+  // with read ahead the data is already decompressed, just copy it.
+  if (ra_ != 0)
+    return got + base_type::xsgetn(s + got, n - got);
+  // the big reads below move ipos_ on without the get area, empty it
+  // so that it still ends at ipos_ (seekpos counts on that).
+  if (n - got >= BUFSZ)
+    this->setg(this->egptr(), this->egptr(), this->egptr());
+  // big reads are decompressed straight into the caller's memory.
+  if constexpr (has_span_decompress<D__>::value) {
+    while (n - got >= BUFSZ) {
+      k = fill_(s + got, n - got);
+      if (k <= 0)
+	return got;
+      got += k;
+      ipos_ += k;
+    }
+  } else while (n - got >= BUFSZ) {
+    std::size_t m = n - got;
+    buffer_ref<char_type,traits_type> b(s + got, 0, m);
+    int r = fill_(b);
+    std::size_t len = b.len();
+    ipos_ += len;
+    if (! b.borrowed()) {
+      // the decompressor needed more room than we had, so b moved the
+      // data to memory of its own. Give the caller what fits and
+      // keep the rest in the get area for later.
+      std::size_t u = len < m ? len : m;
+      traits_type::copy(s + got, b.data(), u);
+      std::size_t rest = len - u;
+      ibuf.clear();
+      traits_type::copy(ibuf.get(rest), b.data() + u, rest);
+      ibuf.inclen(rest);
+      char_type * ibufp = ibuf.data();
+      this->setg(ibufp, ibufp, ibufp + rest);
+      len = u;
+    }
+    got += len;
+    if (r <= 0)
+      return got;
+  }
+  // small reads (and the tail of big ones) go through the get area.
+  if (got < n)
+    got += base_type::xsgetn(s + got, n - got);
+  return got;
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+// virtual
+std::streamsize
+alf::zstreambuf<IST,OST,D__,C__,S__>::xsputn(const char_type * s,
+					 std::streamsize n)
+{
+  if (zos_ == 0)
+    return 0;
+  // small writes go through the put area.
+  if (n < BUFSZ)
+    return base_type::xsputn(s, n);
+  // whatever is in the put area must go to the compressor first to
+  // keep the data in order.
+  if (this->pbase() != 0) {
+    obuf.force_len(this->pptr() - this->pbase());
+    if (obuf.len() > 0) {
+      int k = put_(obuf.data(), obuf.len(), false);
+      obuf.clear();
+      char_type * obufp = obuf.get(BUFSZ);
+      this->setp(obufp, obufp + BUFSZ);
+      if (k < 0)
+	return 0;
+    }
+  }
+  // hand the user's data to the compressor in BULKSZ pieces, no copying.
+  std::streamsize done = 0;
+  while (done < n) {
+    std::streamsize k = n - done;
+    if (k > BULKSZ) k = BULKSZ;
+    if (put_(s + done, k, false) < 0)
+      break;
+    done += k;
+  }
+  return done;
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
 // virtual
-alf::zstreambuf<IST,OST,D__,C__> *
-alf::zstreambuf<IST,OST,D__,C__>::setbuf(char_type * b, std::streamsize n)
+alf::zstreambuf<IST,OST,D__,C__,S__> *
+alf::zstreambuf<IST,OST,D__,C__,S__>::setbuf(char_type * b, std::streamsize n)
 {
   return this;
 }
 
-template <typename IST, typename OST, typename D__, typename C__>
-void
-alf::zstreambuf<IST,OST,D__,C__>::cleanup()
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+// virtual
+typename alf::zstreambuf<IST,OST,D__,C__,S__>::pos_type
+alf::zstreambuf<IST,OST,D__,C__,S__>::seekoff(off_type off,
+					  std::ios_base::seekdir dir,
+					  std::ios_base::openmode which
+					  /* = in | out */)
 {
+  if (zis_ == 0 || ! (which & std::ios_base::in))
+    return pos_type(off_type(-1));
+  // where we are now, tellg ends up here.
+  off_type cur = ipos_ - (this->egptr() - this->gptr());
+  if (dir == std::ios_base::cur) {
+    if (off == 0)
+      return pos_type(cur);
+    off += cur;
+  } else if (dir != std::ios_base::beg) {
+    // we don't know where the end is.
+    return pos_type(off_type(-1));
+  }
+  return seekpos(pos_type(off), which);
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+// virtual
+typename alf::zstreambuf<IST,OST,D__,C__,S__>::pos_type
+alf::zstreambuf<IST,OST,D__,C__,S__>::seekpos(pos_type pos,
+					  std::ios_base::openmode which
+					  /* = in | out */)
+{
+  if (zis_ == 0 || ! (which & std::ios_base::in))
+    return pos_type(off_type(-1));
+  off_type target = pos;
+  if (target < 0)
+    return pos_type(off_type(-1));
+  // inside the get area we just move gptr.
+  off_type start = ipos_ - (this->egptr() - this->eback());
+  if (target >= start && target <= ipos_) {
+    this->setg(this->eback(), this->eback() + (target - start),
+	       this->egptr());
+    return pos;
+  }
+  if constexpr (has_seek<D__>::value) {
+    // the read ahead thread owns zis_ and D_.
+    if (ra_ != 0)
+      return pos_type(off_type(-1));
+    long long in = D_->seek((unsigned long long) target * sizeof(char_type));
+    if (in < 0)
+      return pos_type(off_type(-1));
+    zis_->clear();
+    if (! zis_->seekg(zbase_ + in))
+      return pos_type(off_type(-1));
+    // forget everything we had.
+    zibuf.clear();
+    zibufpos = 0;
+    ibuf.clear();
+    char_type * g = ibuf.get(BUFSZ);
+    this->setg(g, g, g);
+    ipos_ = target;
+    err_ = 0;
+    return pos;
+  } else {
+    return pos_type(off_type(-1));
+  }
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+int
+alf::zstreambuf<IST,OST,D__,C__,S__>::cleanup()
+{
+  int r = 0;
   // flush any output buffer data.
   if (zos_ != 0 && overflow(traits_type::eof()) == traits_type::eof()) {
     // something went wrong during cleanup.
+    r = -1;
   }
+  // stop the read ahead thread.
+  if (ra_ != 0) {
+    {
+      std::lock_guard<std::mutex> l(ra_->m);
+      ra_->stop = true;
+    }
+    ra_->cv.notify_all();
+    ra_->t.join();
+    this->setg(0, 0, 0);
+    delete ra_;
+    ra_ = 0;
+  }
+  return r;
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+void
+alf::zstreambuf<IST,OST,D__,C__,S__>::allocator(zallocator * a)
+{
+  // with zstats the buffers count their reallocations on the way.
+  a = stats().counted(a);
+  ibuf.allocator(a);
+  obuf.allocator(a);
+  zibuf.allocator(a);
+  zobuf.allocator(a);
 }
 
-template <typename IST, typename OST, typename D__, typename C__>
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
 int
-alf::zstreambuf<IST,OST,D__,C__>::read_in_(zibuf_type & b)
+alf::zstreambuf<IST,OST,D__,C__,S__>::rebind(istream_type * isp,
+					 ostream_type * osp)
+{
+  int r = cleanup();
+  if constexpr (has_reset<D__>::value) {
+    if (D_ != 0)
+      D_->reset();
+  }
+  if constexpr (has_reset<C__>::value) {
+    if (C_ != 0)
+      C_->reset();
+  }
+  // empty, but they keep their memory.
+  ibuf.clear();
+  obuf.clear();
+  zibuf.clear();
+  zobuf.clear();
+  zibufpos = 0;
+  ipos_ = 0;
+  err_ = 0;
+  init(isp, osp, D_, C_);
+  return r;
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+int
+alf::zstreambuf<IST,OST,D__,C__,S__>::readahead(std::size_t depth
+					    /* = 4 */,
+					    std::size_t chunk
+					    /* = BULKSZ */)
+{
+  if (zis_ == 0 || ra_ != 0)
+    return -1;
+  // one chunk for the get area and at least one for the thread.
+  if (depth < 2) depth = 2;
+  if (chunk < BUFSZ) chunk = BUFSZ;
+  ra_ = new readahead_type;
+  ra_->bufs.resize(depth);
+  for (std::size_t i = 0; i < depth; ++i)
+    ra_->bufs[i].allocator(ibuf.allocator());
+  ra_->lens.resize(depth);
+  ra_->depth = depth;
+  ra_->chunk = chunk;
+  ra_->head = ra_->tail = ra_->ready = 0;
+  ra_->held = ra_->stop = false;
+  // what is left in the get area is handed out before the first chunk.
+  ra_->t = std::thread(&zstreambuf::readahead_run_, this);
+  return 0;
+}
+
+// the read ahead thread, fills the chunks in the ring in turn.
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+void
+alf::zstreambuf<IST,OST,D__,C__,S__>::readahead_run_()
+{
+  readahead_type & R = *ra_;
+  // 1 while there is more, otherwise 0 (eof) or < 0 (error) which
+  // goes to the reader in a chunk of its own after the data.
+  std::streamsize end = 1;
+  for (;;) {
+    std::size_t i;
+    {
+      std::unique_lock<std::mutex> l(R.m);
+      R.cv.wait(l, [&R] { return R.stop || R.ready < R.depth; });
+      if (R.stop)
+	return;
+      i = R.tail;
+    }
+    ibuf_type & b = R.bufs[i];
+    std::streamsize k = 0;
+    if (end > 0) {
+      b.clear();
+      std::streamsize r = 0;
+      if constexpr (has_span_decompress<D__>::value) {
+	char_type * p = b.get(R.chunk);
+	while (k < R.chunk && (r = fill_(p + k, R.chunk - k)) > 0)
+	  k += r;
+	b.inclen(k);
+      } else {
+	while (b.len() < R.chunk && (r = fill_(b)) > 0)
+	  ;
+	k = b.len();
+      }
+      if (r <= 0)
+	end = r;
+    }
+    if (k == 0)
+      k = end;
+    {
+      std::lock_guard<std::mutex> l(R.m);
+      R.lens[i] = k;
+      R.tail = (i + 1) % R.depth;
+      ++R.ready;
+    }
+    R.cv.notify_all();
+    if (k <= 0)
+      return;
+  }
+}
+
+// underflow with read ahead, give back the chunk we're done with and
+// wait for the next.
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+typename alf::zstreambuf<IST,OST,D__,C__,S__>::int_type
+alf::zstreambuf<IST,OST,D__,C__,S__>::readahead_underflow_()
+{
+  readahead_type & R = *ra_;
+  std::unique_lock<std::mutex> l(R.m);
+  if (R.held) {
+    // eof and errors stay.
+    if (R.lens[R.head] <= 0)
+      return traits_type::eof();
+    R.head = (R.head + 1) % R.depth;
+    --R.ready;
+    R.held = false;
+    R.cv.notify_all();
+  }
+  R.cv.wait(l, [&R] { return R.ready > 0; });
+  R.held = true;
+  std::streamsize k = R.lens[R.head];
+  if (k <= 0) {
+    this->setg(0, 0, 0);
+    return traits_type::eof();
+  }
+  char_type * p = R.bufs[R.head].data();
+  this->setg(p, p, p + k);
+  ipos_ += k;
+  return traits_type::to_int_type(*this->gptr());
+}
+
+// read and decompress until we have some more data in b or reach eof.
+// returns the number of chars added to b, 0 at eof and < 0 on error.
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+int
+alf::zstreambuf<IST,OST,D__,C__,S__>::fill_(ibuf_type & b)
+{
+  std::size_t n = b.len();
+  while (b.len() == n) {
+    // the decompressor takes all of zibuf every time.
+    zibuf.clear();
+    int r = read_in_(zibuf);
+    // at eof we call it with an empty buffer to flush out the rest.
+    std::size_t m = b.len();
+    int k;
+    {
+      typename S__::timer t(stats(), S__::CODEC);
+      k = D_->decompress(b, zibuf, r < 0);
+    }
+    stats().count(S__::DECOMPRESS_CALLS);
+    stats().count(S__::BYTES_IN, zibuf.len());
+    stats().count(S__::BYTES_OUT, b.len() - m);
+    if (k < 0) {
+      if (err_ == 0)
+	err_ = k;
+      return k;
+    }
+    if (r < 0)
+      break;
+  }
+  return b.len() - n;
+}
+
+// decompress into the m chars at p. Same as above except that we stop
+// when p is full, so there may be compressed data left in zibuf for
+// next time.
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+std::streamsize
+alf::zstreambuf<IST,OST,D__,C__,S__>::fill_(char_type * p, std::size_t m)
+{
+  std::size_t got = 0;
+  bool is_eof = false;
+  while (got < m) {
+    if (zibufpos == zibuf.len()) {
+      // don't wait for more input if we already have something.
+      if (got > 0)
+	break;
+      zibuf.clear();
+      zibufpos = 0;
+      is_eof = read_in_(zibuf) < 0;
+    }
+    zresult z;
+    {
+      typename S__::timer t(stats(), S__::CODEC);
+      z = D_->decompress(span<const istream_char_type>(zibuf.data() + zibufpos,
+						       zibuf.len() - zibufpos),
+			 span<char_type>(p + got, m - got), is_eof);
+    }
+    stats().count(S__::DECOMPRESS_CALLS);
+    stats().count(S__::BYTES_IN, z.consumed);
+    stats().count(S__::BYTES_OUT, z.produced);
+    if (z.ret < 0) {
+      if (err_ == 0)
+	err_ = z.ret;
+      return z.ret;
+    }
+    zibufpos += z.consumed;
+    got += z.produced;
+    if (z.ret > 0 || (is_eof && z.produced == 0))
+      break;
+  }
+  return got;
+}
+
+// compress the n chars at p and write the result to the attached stream.
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+int
+alf::zstreambuf<IST,OST,D__,C__,S__>::put_(const char_type * p, std::size_t n,
+				       bool flush)
+{
+  if (flush)
+    stats().count(S__::FLUSHES);
+  if constexpr (has_span_compress<C__>::value) {
+    // compress from p straight into zobuf, or into the ostream's own
+    // memory if it lends it to us.
+    for (;;) {
+      ostream_char_type * q;
+      std::size_t room = BUFSZ;
+      if constexpr (has_reserve<OST>::value) {
+	typename S__::timer t(stats(), S__::WRITE);
+	if (zos_ == 0 || (q = zos_->reserve(room)) == 0)
+	  return -1;
+      } else {
+	q = zobuf.get(BUFSZ);
+	room = zobuf.avail();
+      }
+      zresult z;
+      {
+	typename S__::timer t(stats(), S__::CODEC);
+	z = C_->compress(span<const char_type>(p, n),
+			 span<ostream_char_type>(q, room), flush);
+      }
+      stats().count(S__::COMPRESS_CALLS);
+      stats().count(S__::BYTES_IN, z.consumed);
+      stats().count(S__::BYTES_OUT, z.produced);
+      if (z.ret < 0)
+	return z.ret;
+      p += z.consumed;
+      n -= z.consumed;
+      if constexpr (has_reserve<OST>::value) {
+	typename S__::timer t(stats(), S__::WRITE);
+	zos_->commit(z.produced);
+	stats().count(S__::WRITES);
+	stats().count(S__::BYTES_WRITTEN, z.produced);
+      } else {
+	zobuf.inclen(z.produced);
+	std::size_t zlen = zobuf.len();
+	if (zlen > 0) {
+	  int u = write_out_(zobuf);
+	  zobuf.clear();
+	  if (u != zlen)
+	    return -1;
+	}
+      }
+      // done when the stream ended or it has taken it all and had
+      // room to spare.
+      if (z.ret > 0 || (n == 0 && z.produced < room))
+	return 0;
+    }
+  } else {
+    buffer_ref<char_type,traits_type> b(p, n);
+    std::size_t m = zobuf.len();
+    int k;
+    {
+      typename S__::timer t(stats(), S__::CODEC);
+      k = C_->compress(zobuf, b, flush);
+    }
+    stats().count(S__::COMPRESS_CALLS);
+    stats().count(S__::BYTES_IN, n);
+    stats().count(S__::BYTES_OUT, zobuf.len() - m);
+    if (k < 0)
+      return k;
+    std::size_t zlen = zobuf.len();
+    if (zlen > 0) {
+      int u = write_out_(zobuf);
+      zobuf.clear();
+      if (u != zlen)
+	return -1;
+    }
+    return 0;
+  }
+}
+
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
+int
+alf::zstreambuf<IST,OST,D__,C__,S__>::read_in_(zibuf_type & b)
 {
   if (zis_ == 0)
     return -1;
   if (! *zis_ )
     return -1;
+  typename S__::timer t(stats(), S__::READ);
+  stats().count(S__::READS);
   // Dang, wish there was a function like readsome but which would
   // underflow() its buffer when reaching the end.
   // Have to use read() here and get the chars read from somewhere
@@ -181,12 +644,22 @@ alf::zstreambuf<IST,OST,D__,C__>::read_in_(zibuf_type & b)
   // as we can read the eof next time when we get no chars.
   std::streamsize k;
 
+  if constexpr (has_view<IST>::value) {
+    // no copying, b just shows the next part of the istream's memory.
+    const istream_char_type * v;
+    k = zis_->view(v, VIEWSZ);
+    if (k <= 0)
+      return -1;
+    b.borrow(v, k);
+    stats().count(S__::BYTES_READ, k);
+    return k;
+  }
   std::size_t n = b.avail();
   if (n < 4096) {
     b.ensure(4096);
     n = b.avail();
   }
-  char_type * p = b.get(n);
+  istream_char_type * p = b.get(n);
   if (! zis_->read(p, n)) {
     k = zis_->gcount();
     // if eof it will be set again when we call read next time.
@@ -197,20 +670,25 @@ alf::zstreambuf<IST,OST,D__,C__>::read_in_(zibuf_type & b)
   if (k > 0) {
     zis_->clear();
     b.inclen(k);
+    stats().count(S__::BYTES_READ, k);
   }
   return k;
 }
 
-template <typename IST, typename OST, typename D__, typename C__>
+template <typename IST, typename OST, typename D__, typename C__,
+	  typename S__>
 int
-alf::zstreambuf<IST,OST,D__,C__>::write_out_(const zobuf_type & b)
+alf::zstreambuf<IST,OST,D__,C__,S__>::write_out_(const zobuf_type & b)
 {
   if (zos_ == 0)
     return -1;
   if (! *zos_)
     return -1;
+  typename S__::timer t(stats(), S__::WRITE);
+  stats().count(S__::WRITES);
   if (! zos_->write(b.data(), b.len()))
     return -1;
+  stats().count(S__::BYTES_WRITTEN, b.len());
   return b.len();
 }
 
@@ -242,184 +720,822 @@ alf::buffer<ChT,TrT>::align(std::size_t a, char_type fill /* = char_type() */)
 /////////////////////////
 // DefaultCompressor
 
-template <typename IChT, typename ITrT, typename OChT, typename OTrT>
-alf::DefaultCompressor<IChT,ITrT,OChT,OTrT>::DefaultCompressor()
+template <typename IChT, typename ITrT, typename OChT, typename OTrT,
+	  typename S>
+alf::DefaultCompressor<IChT,ITrT,OChT,OTrT,S>::
+DefaultCompressor(const zoptions & opt /* = zoptions() */)
+  : O(opt)
 {
-  U.ensure(8192);
-  C.ensure(8192);
   // initialize s_stream.
   Z.total_in = 0;
   Z.total_out = 0;
   Z.msg = 0;
   Z.state = 0;
-  Z.zalloc = 0;
-  Z.zfree = 0;
-  Z.opaque = 0;
+  // zlib's own memory from the allocator if we have one.
+  Z.zalloc = O.allocator() != 0 ? zallocator::zalloc : 0;
+  Z.zfree = O.allocator() != 0 ? zallocator::zfree : 0;
+  Z.opaque = O.allocator();
   Z.data_type = Z_TEXT;
   Z.adler = 0;
   Z.reserved = 0;
-  ret = deflateInit(&Z, 9);
+  ret = deflateInit2(&Z, O.level(), Z_DEFLATED, O.zlib_wbits(false),
+		     O.memlevel(), O.strategy());
 }
 
-template <typename IChT, typename ITrT, typename OChT, typename OTrT>
-int
-alf::DefaultCompressor<IChT,ITrT,OChT,OTrT>::
-compress(cout_buf_type & d, const cin_buf_type & s, bool flush /* = false */)
+template <typename IChT, typename ITrT, typename OChT, typename OTrT,
+	  typename S>
+alf::DefaultCompressor<IChT,ITrT,OChT,OTrT,S> &
+alf::DefaultCompressor<IChT,ITrT,OChT,OTrT,S>::reset()
 {
-  // first copy the data to U.
-  std::size_t len = s.len();
-  std::size_t blen = len * sizeof(cin_char_type);
-  char * p = U.get(blen);
-  cin_traits_type::move(reinterpret_cast<cin_char_type *>(p), s.data(), len);
-  U.inclen(blen);
-  std::size_t ulen = U.len();
-  int flush_ = flush || len == 0;
-  int r = Z_OK;
-  if (flush_ || ulen >= 8192) {
-    // compress what we have in U.
-    unsigned char * pp = reinterpret_cast<unsigned char *>(U.data());
-    Z.next_in = pp;
-    Z.avail_in = ulen;
-    // twice U.len() should suffice - we are supposed to compress
-    // so in practice we should need less than ulen normally.
-    unsigned char * q = reinterpret_cast<unsigned char *>(C.get(ulen << 1));
-    Z.next_out = q;
-    Z.avail_out = C.avail();
-    if ((r = ret = deflate(&Z, flush_)) == Z_OK) {
-      std::size_t k_in = Z.next_in - pp;
-      std::size_t k_out = Z.next_out - q;
-      // only take out whole chars to output.
-      std::size_t n = k_out / sizeof(cout_char_type);
-      std::size_t n_c = n * sizeof(cout_char_type);
-      std::size_t rest = k_out - n_c;
-      // n == size in number of chars
-      // copy this to output buffer d.
-      C.force_len(n*sizeof(cin_char_type));
-      cout_traits_type::move(d.get(n),
-			     reinterpret_cast<cout_char_type *>(C.data()), n);
-      d.inclen(n);
-      // if we want to flush we shouldn't have any data left in rest.
-      if (flush_ && rest != 0) {
-	q = reinterpret_cast<unsigned char *>(C.get(sizeof(cin_char_type)));
-	// rest bytes filled with data, need to fill remaining s_ - rest.
-	std::memset(q + rest, 0, sizeof(cin_char_type) - rest);
-	cout_traits_type::move(d.get(1),
-			       reinterpret_cast<cout_char_type *>
-			       (C.data()) + n,
-			       1);
-	d.inclen(1);
-	rest = 0;
-      }
-      // move remaining stuff to beginning of C.
-      if (rest) std::memmove(C.data(), C.data() + n_c, rest);
-      C.force_len(rest);
-      // ditto for input buffer U.
-      n = k_in / sizeof(cin_char_type);
-      n_c = n * sizeof(cin_char_type);
-      rest = k_in - n_c;
-      // if input buffer has any data left while flusing something
-      // is very wrong.
-      if (flush_ && rest != 0) {
-	// panic!, some data were not compressed!
-	throw "Some data were not compressed";
-      }
-      // move rest bytes at end to beginning of U.
-      if (rest) std::memmove(U.data(), U.data() + n_c, rest);
-      U.force_len(rest);
-    }
+  ret = deflateReset(&Z);
+  B.clear();
+  return *this;
+}
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT,
+	  typename S>
+alf::zresult
+alf::DefaultCompressor<IChT,ITrT,OChT,OTrT,S>::
+compress(span<const cin_char_type> in, span<cout_char_type> out,
+	 bool flush /* = false */)
+{
+  zresult res = { 0, 0, Z_OK };
+  if (out.len() == 0)
+    return res;
+  const unsigned char * ip;
+  unsigned char * op;
+  std::size_t ilen, olen;
+  // zlib reads from in and writes to out, after the start of a char
+  // left over from last time.
+  B.begin(in, out, ip, ilen, op, olen);
+  Z.next_in = const_cast<unsigned char *>(ip);
+  Z.avail_in = ilen;
+  Z.next_out = op;
+  Z.avail_out = olen;
+  int flush_ = flush ? Z_FINISH : Z_NO_FLUSH;
+  int r;
+  {
+    typename S::timer t(stats(), S::CODEC);
+    r = ret = deflate(&Z, flush_);
   }
-  return r;
+  stats().count(S::COMPRESS_CALLS);
+  // Z_BUF_ERROR only means there was nothing to do.
+  if (r == Z_BUF_ERROR)
+    r = Z_OK;
+  if (r < 0) {
+    res.ret = r;
+    return res;
+  }
+  std::size_t k_in = Z.next_in - ip;
+  std::size_t k_out = Z.next_out - op;
+  stats().count(S::BYTES_IN, k_in);
+  stats().count(S::BYTES_OUT, k_out);
+  // if we flush, fill up a split char at the end.
+  res = B.done(k_in, k_out, flush && Z.avail_in == 0 && Z.avail_out != 0);
+  // the stream is done, get ready for the next. A flush may take
+  // several calls, it is counted once here.
+  if (r == Z_STREAM_END) {
+    stats().count(S::FLUSHES);
+    ret = deflateReset(&Z);
+  }
+  res.ret = r;
+  return res;
 }
 
 /////////////////////////
 // DefaultDecompressor
 
-template <typename OChT, typename OTrT, typename IChT, typename ITrT>
-alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT>::DefaultDecompressor()
+template <typename OChT, typename OTrT, typename IChT, typename ITrT,
+	  typename S>
+alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT,S>::
+DefaultDecompressor(const zoptions & opt /* = zoptions(zoptions::AUTO) */)
+  : O(opt), X(0), inpos(0), outpos(0), discard(0),
+    prime(0), wrap(opt.frame()), raw(false), between(false), tail(0)
 {
-  U.ensure(8192);
-  C.ensure(8192);
   // initialize s_stream.
   Z.total_in = 0;
   Z.total_out = 0;
   Z.msg = 0;
   Z.state = 0;
-  Z.zalloc = 0;
-  Z.zfree = 0;
-  Z.opaque = 0;
+  // zlib's own memory from the allocator if we have one.
+  Z.zalloc = O.allocator() != 0 ? zallocator::zalloc : 0;
+  Z.zfree = O.allocator() != 0 ? zallocator::zfree : 0;
+  Z.opaque = O.allocator();
   Z.data_type = Z_TEXT;
   Z.adler = 0;
   Z.reserved = 0;
-  ret = inflateInit(&Z);
+  Z.next_in = 0;
+  Z.avail_in = 0;
+  ret = inflateInit2(&Z, O.zlib_wbits(true));
 }
 
-template <typename OChT, typename OTrT, typename IChT, typename ITrT>
-int
-alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT>::
-decompress(dout_buf_type & d, const din_buf_type & s, bool flush /* = false */)
-{
-  // first copy the data to C.
-  std::size_t len = s.len();
-  char * p = C.get(len);
-  std::memcpy(p, reinterpret_cast<const char *>(s.data()), len);
-  C.inclen(len);
-  std::size_t clen = C.len();
-  int flush_ = flush || len < s.cap();
-  int r = Z_OK;
-  if (flush_ || clen >= 8192) {
-    // decompress what we have in C.
-    unsigned char * pp = reinterpret_cast<unsigned char *>(C.data());
-    Z.next_in = pp;
-    Z.avail_in = clen;
-    // Eight times C.len() should hopefully suffice.
-    unsigned char * q = reinterpret_cast<unsigned char *>(U.get(clen << 3));
-    Z.next_out = q;
-    Z.avail_out = U.avail();
-    if ((r = ret = inflate(&Z, flush)) == Z_OK) {
-      std::size_t k_in = Z.next_in - pp;
-      std::size_t k_out = Z.next_out - q;
-      // only take out whole chars to output.
-      std::size_t n = k_out / sizeof(dout_char_type);
-      std::size_t n_c = n * sizeof(dout_char_type);
-      std::size_t rest = k_out - n_c;
-      // n == size in number of chars
-      // copy this to output buffer d.
-      U.force_len(n*sizeof(dout_char_type));
-      dout_traits_type::move(d.get(n),
-			     reinterpret_cast<dout_char_type *>(U.data()), n);
-      d.inclen(n);
-      // if we want to flush, we should have no rest bytes
-      // if we do have any, add enough bytes to make a char and move it
-      // as well.
-      if (flush_ && rest != 0) {
-	q = reinterpret_cast<unsigned char *>(U.get(sizeof(dout_char_type)));
-	// rest bytes filled with data, need to fill remaining
-	// sizeof(dout_char_type) - rest.
-	std::memset(q + rest, 0, sizeof(dout_char_type) - rest);
-	dout_traits_type::move(d.get(1),
-			       reinterpret_cast<dout_char_type *>
-			       (U.data()) + n,
-			       1);
-	d.inclen(1);
-	rest = 0;
-      }
+template <typename OChT, typename OTrT, typename IChT, typename ITrT,
+	  typename S>
+alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT,S> &
+alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT,S>::reset()
+{
+  // a seek may have left it raw, so with the window bits again.
+  ret = inflateReset2(&Z, O.zlib_wbits(true));
+  B.clear();
+  X = 0;
+  inpos = outpos = discard = 0;
+  prime = 0;
+  wrap = O.frame();
+  raw = between = false;
+  tail = 0;
+  return *this;
+}
 
-      // move remaining stuff to beginning of U.
-      if (rest) std::memmove(U.data(), U.data() + n_c, rest);
-      U.force_len(rest);
-      // ditto for input buffer C.
-      n = k_in / sizeof(din_char_type);
-      n_c = n * sizeof(din_char_type);
-      rest = k_in - n_c;
-      // if we are flusing and we have data remaining in rest
-      // we panic.
-      if (flush_ && rest != 0) {
-	throw "Some data were not decompressed.";
+template <typename OChT, typename OTrT, typename IChT, typename ITrT,
+	  typename S>
+alf::zresult
+alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT,S>::
+decompress(span<const din_char_type> in, span<dout_char_type> out,
+	   bool flush /* = false */)
+{
+  zresult res = { 0, 0, Z_OK };
+  if (out.len() == 0)
+    return res;
+  const unsigned char * ip;
+  unsigned char * op;
+  std::size_t ilen, olen;
+  // zlib reads from in and writes to out, after the start of a char
+  // left over from last time.
+  B.begin(in, out, ip, ilen, op, olen);
+  Z.next_in = const_cast<unsigned char *>(ip);
+  Z.avail_in = ilen;
+  unsigned char * o = op;
+  std::size_t oroom = olen;
+  // which framing the data has, for AUTO the first byte tells.
+  if (wrap == zoptions::AUTO && inpos == 0 && ! raw && Z.avail_in > 0)
+    wrap = *Z.next_in == 0x1f ? zoptions::GZIP : zoptions::ZLIB;
+  // after a seek into the middle of a byte, the first byte has the
+  // rest of the bits.
+  if (prime != 0 && Z.avail_in > 0) {
+    inflatePrime(&Z, prime, *Z.next_in >> (8 - prime));
+    ++Z.next_in;
+    --Z.avail_in;
+    ++inpos;
+    prime = 0;
+  }
+  // with an index zlib stops at each deflate block so we can see if
+  // it is time for a new point.
+  int mode = X != 0 ? Z_BLOCK : Z_NO_FLUSH;
+  int r;
+  for (;;) {
+    if (between) {
+      // after a gzip member, first its trailer if zlib is raw and
+      // didn't take it, then maybe the header of the next member.
+      std::size_t t = tail < Z.avail_in ? tail : Z.avail_in;
+      Z.next_in += t;
+      Z.avail_in -= t;
+      tail -= t;
+      inpos += t;
+      if (Z.avail_in == 0) {
+	// can't tell yet, unless there is no more.
+	r = flush ? Z_STREAM_END : Z_OK;
+	break;
       }
-      // move rest bytes at end to beginning of U.
-      if (rest) std::memmove(C.data(), C.data() + n_c, rest);
-      C.force_len(rest);
+      if (*Z.next_in != 0x1f) {
+	// not a gzip header, the rest is not ours.
+	r = Z_STREAM_END;
+	break;
+      }
+      if ((r = ret = inflateReset2(&Z, O.wbits() + 16)) != Z_OK)
+	break;
+      between = false;
+    }
+    // after a seek out is just a place to throw away data.
+    bool dropping = discard > 0;
+    unsigned char * i0 = Z.next_in;
+    Z.next_out = o;
+    Z.avail_out = dropping && discard < oroom ? discard : oroom;
+    {
+      typename S::timer t(stats(), S::CODEC);
+      r = ret = inflate(&Z, mode);
     }
+    std::size_t got = Z.next_out - o;
+    stats().count(S::DECOMPRESS_CALLS);
+    stats().count(S::BYTES_IN, Z.next_in - i0);
+    stats().count(S::BYTES_OUT, got);
+    inpos += Z.next_in - i0;
+    outpos += got;
+    if (dropping) {
+      discard -= got;
+    } else {
+      o += got;
+      oroom -= got;
+    }
+    // Z_BUF_ERROR only means zlib needs more input.
+    if (r == Z_BUF_ERROR) {
+      r = Z_OK;
+      break;
+    }
+    if (r == Z_STREAM_END && wrap == zoptions::GZIP) {
+      // the end of a member, see above.
+      between = true;
+      tail = raw ? 8 : 0;
+      raw = false;
+      continue;
+    }
+    if (r != Z_OK)
+      break;
+    // a point at the end of each block (but not the last) span bytes
+    // after the one before.
+    if (X != 0 && (Z.data_type & 128) && ! (Z.data_type & 64) &&
+	(X->size() == 0 ? ! X->complete() :
+	 outpos >= (*X)[X->size() - 1].out + X->span())) {
+      X->set_frame(wrap);
+      zindex::point & pt = X->add();
+      pt.out = outpos;
+      pt.in = inpos;
+      pt.bits = Z.data_type & 7;
+      uInt wlen = zindex::WINSIZE;
+      inflateGetDictionary(&Z, pt.window, &wlen);
+      pt.wlen = wlen;
+    }
+    if (Z.avail_in == 0 || oroom == 0)
+      break;
+  }
+  if (r == Z_STREAM_END && X != 0 && ! X->complete())
+    X->set_complete(outpos, inpos);
+  if (r < 0) {
+    res.ret = r;
+    return res;
   }
+  // if we flush or the stream ended, fill up a split char at the end.
+  res = B.done(Z.next_in - ip, o - op,
+	       (flush || r == Z_STREAM_END) && Z.avail_in == 0 && oroom != 0);
+  // anything after the end of the stream is thrown away.
+  if (r == Z_STREAM_END)
+    B.take_all(res, in.len());
+  res.ret = r;
+  return res;
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT,
+	  typename S>
+long long
+alf::DefaultDecompressor<OChT,OTrT,IChT,ITrT,S>::seek(unsigned long long off)
+{
+  const zindex::point * pt = X != 0 ? X->find(off) : 0;
+  B.clear();
+  if (pt == 0) {
+    // no point before off, start over from the beginning.
+    if ((ret = inflateReset2(&Z, O.zlib_wbits(true))) != Z_OK)
+      return -1;
+    inpos = outpos = 0;
+    discard = off;
+    prime = 0;
+    wrap = O.frame();
+    raw = between = false;
+    tail = 0;
+    return 0;
+  }
+  // raw inflate from the point on, with what came before as dictionary.
+  if ((ret = inflateReset2(&Z, -MAX_WBITS)) != Z_OK ||
+      (ret = inflateSetDictionary(&Z, pt->window, pt->wlen)) != Z_OK)
+    return -1;
+  prime = pt->bits;
+  inpos = pt->in - (prime != 0 ? 1 : 0);
+  outpos = pt->out;
+  discard = off - pt->out;
+  if (X->frame() >= 0)
+    wrap = zoptions::framing(X->frame());
+  raw = true;
+  between = false;
+  tail = 0;
+  return inpos;
+}
+
+/////////////////////////
+// ParallelCompressor
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+int
+alf::ParallelCompressor<IChT,ITrT,OChT,OTrT>::
+compress(cout_buf_type & d, const cin_buf_type & s, bool flush /* = false */)
+{
+  bool flush_ = flush || s.len() == 0;
+  int r = compress_(reinterpret_cast<const char *>(s.data()),
+		    s.len() * sizeof(cin_char_type), flush_);
+  // at the end of the stream fill up the last char.
+  if (flush_)
+    O.align(sizeof(cout_char_type));
+  // only take out whole chars to output, the rest waits in O.
+  std::size_t n = O.len() / sizeof(cout_char_type);
+  std::size_t n_c = n * sizeof(cout_char_type);
+  std::size_t rest = O.len() - n_c;
+  cout_traits_type::copy(d.get(n),
+			 reinterpret_cast<const cout_char_type *>(O.data()),
+			 n);
+  d.inclen(n);
+  if (rest) std::memmove(O.data(), O.data() + n_c, rest);
+  O.force_len(rest);
   return r;
 }
+
+/////////////////////////
+// zcompress_buffer, zdecompress_buffer
+
+template <typename C>
+int
+alf::zcompress_buffer(C & c, typename C::cout_buf_type & d,
+		      const typename C::cin_buf_type & s, bool flush,
+		      std::size_t chunk)
+{
+  typedef typename C::cin_char_type cin_char_type;
+  typedef typename C::cout_char_type cout_char_type;
+  // compress straight from s into d, growing d as needed until
+  // the codec has taken all of s and has nothing more to give.
+  const cin_char_type * p = s.data();
+  std::size_t n = s.len();
+  bool flush_ = flush || n == 0;
+  std::size_t want = n * sizeof(cin_char_type) / sizeof(cout_char_type);
+  if (want < chunk) want = chunk;
+  for (;;) {
+    cout_char_type * q = d.get(want);
+    std::size_t room = d.avail();
+    zresult z = c.compress(span<const cin_char_type>(p, n),
+			   span<cout_char_type>(q, room), flush_);
+    if (z.ret < 0)
+      return z.ret;
+    d.inclen(z.produced);
+    p += z.consumed;
+    n -= z.consumed;
+    if (z.ret > 0 || (n == 0 && z.produced < room))
+      return z.ret;
+  }
+}
+
+template <typename D>
+int
+alf::zdecompress_buffer(D & dc, typename D::dout_buf_type & d,
+			const typename D::din_buf_type & s, bool flush,
+			std::size_t chunk)
+{
+  typedef typename D::din_char_type din_char_type;
+  typedef typename D::dout_char_type dout_char_type;
+  // decompress straight from s into d, growing d as needed until
+  // the codec has taken all of s and has nothing more to give.
+  const din_char_type * p = s.data();
+  std::size_t n = s.len();
+  // Four times the size of s is usually enough.
+  std::size_t want = (n * sizeof(din_char_type) << 2) / sizeof(dout_char_type);
+  if (want < chunk) want = chunk;
+  for (;;) {
+    dout_char_type * q = d.get(want);
+    std::size_t room = d.avail();
+    zresult z = dc.decompress(span<const din_char_type>(p, n),
+			      span<dout_char_type>(q, room), flush);
+    if (z.ret < 0)
+      return z.ret;
+    d.inclen(z.produced);
+    p += z.consumed;
+    n -= z.consumed;
+    if (z.ret > 0 || (n == 0 && z.produced < room))
+      return z.ret;
+  }
+}
+
+#ifdef ZSTREAM_WITH_ZSTD
+
+/////////////////////////
+// ZstdCompressor
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+alf::ZstdCompressor<IChT,ITrT,OChT,OTrT>::
+ZstdCompressor(int level /* = ZSTD_CLEVEL_DEFAULT */,
+	       std::size_t chunk /* = 8192 */)
+  : Z(ZSTD_createCCtx()), ret(0), chunk_(chunk != 0 ? chunk : 1)
+{
+  if (Z == 0)
+    throw "ZSTD_createCCtx failed";
+  ret = ZSTD_CCtx_setParameter(Z, ZSTD_c_compressionLevel, level);
+  if (! ZSTD_isError(ret))
+    ret = ZSTD_CCtx_setParameter(Z, ZSTD_c_checksumFlag, 1);
+}
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+alf::ZstdCompressor<IChT,ITrT,OChT,OTrT> &
+alf::ZstdCompressor<IChT,ITrT,OChT,OTrT>::reset()
+{
+  // the parameters stay.
+  ret = ZSTD_CCtx_reset(Z, ZSTD_reset_session_only);
+  B.clear();
+  return *this;
+}
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+alf::zresult
+alf::ZstdCompressor<IChT,ITrT,OChT,OTrT>::
+compress(span<const cin_char_type> in, span<cout_char_type> out,
+	 bool flush /* = false */)
+{
+  zresult res = { 0, 0, 0 };
+  if (out.len() == 0)
+    return res;
+  if (ZSTD_isError(ret)) {
+    res.ret = -1;
+    return res;
+  }
+  const unsigned char * ip;
+  unsigned char * op;
+  std::size_t ilen, olen;
+  B.begin(in, out, ip, ilen, op, olen);
+  ZSTD_inBuffer ib = { ip, ilen, 0 };
+  ZSTD_outBuffer ob = { op, olen, 0 };
+  // with ZSTD_e_end it returns 0 when the frame is all out.
+  ret = ZSTD_compressStream2(Z, &ob, &ib,
+			     flush ? ZSTD_e_end : ZSTD_e_continue);
+  if (ZSTD_isError(ret)) {
+    res.ret = -1;
+    return res;
+  }
+  bool ended = flush && ret == 0;
+  res = B.done(ib.pos, ob.pos, ended);
+  res.ret = ended ? 1 : 0;
+  return res;
+}
+
+/////////////////////////
+// ZstdDecompressor
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::ZstdDecompressor<OChT,OTrT,IChT,ITrT>::
+ZstdDecompressor(std::size_t chunk /* = 8192 */)
+  : Z(ZSTD_createDCtx()), ret(0), chunk_(chunk != 0 ? chunk : 1)
+{
+  if (Z == 0)
+    throw "ZSTD_createDCtx failed";
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::ZstdDecompressor<OChT,OTrT,IChT,ITrT> &
+alf::ZstdDecompressor<OChT,OTrT,IChT,ITrT>::reset()
+{
+  ZSTD_DCtx_reset(Z, ZSTD_reset_session_only);
+  ret = 0;
+  B.clear();
+  return *this;
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::zresult
+alf::ZstdDecompressor<OChT,OTrT,IChT,ITrT>::
+decompress(span<const din_char_type> in, span<dout_char_type> out,
+	   bool flush /* = false */)
+{
+  zresult res = { 0, 0, 0 };
+  if (out.len() == 0)
+    return res;
+  const unsigned char * ip;
+  unsigned char * op;
+  std::size_t ilen, olen;
+  B.begin(in, out, ip, ilen, op, olen);
+  ZSTD_inBuffer ib = { ip, ilen, 0 };
+  ZSTD_outBuffer ob = { op, olen, 0 };
+  // zstd may keep output back when out is full, keep calling until
+  // out is full or nothing moves. Between frames (ret == 0) there is
+  // nothing to get without input, and a call would only give us the
+  // size of the next frame header instead of the 0 we have.
+  while (ob.pos < ob.size && (ib.pos < ib.size || ret != 0)) {
+    std::size_t i0 = ib.pos, o0 = ob.pos;
+    ret = ZSTD_decompressStream(Z, &ob, &ib);
+    if (ZSTD_isError(ret)) {
+      res.ret = -1;
+      return res;
+    }
+    if (ib.pos == i0 && ob.pos == o0)
+      break;
+  }
+  // at the end of the input we should be between frames.
+  if (flush && ilen == 0 && ob.pos == 0 && ret != 0) {
+    res.ret = -1;
+    return res;
+  }
+  return B.done(ib.pos, ob.pos, flush && ib.pos == ilen && ret == 0);
+}
+
+#endif // ZSTREAM_WITH_ZSTD
+
+#ifdef ZSTREAM_WITH_LZ4
+
+/////////////////////////
+// Lz4Compressor
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+alf::Lz4Compressor<IChT,ITrT,OChT,OTrT>::
+Lz4Compressor(int level /* = 0 */, std::size_t chunk /* = 8192 */)
+  : Z(0), ret(0), chunk_(chunk != 0 ? chunk : 1), spos(0),
+    begun(false), ended(false)
+{
+  ret = LZ4F_createCompressionContext(&Z, LZ4F_VERSION);
+  if (LZ4F_isError(ret))
+    throw "LZ4F_createCompressionContext failed";
+  std::memset(&P, 0, sizeof(P));
+  P.compressionLevel = level;
+  P.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+}
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+alf::Lz4Compressor<IChT,ITrT,OChT,OTrT> &
+alf::Lz4Compressor<IChT,ITrT,OChT,OTrT>::reset()
+{
+  // LZ4F_compressBegin starts the context over.
+  S.clear();
+  spos = 0;
+  begun = ended = false;
+  ret = 0;
+  B.clear();
+  return *this;
+}
+
+template <typename IChT, typename ITrT, typename OChT, typename OTrT>
+alf::zresult
+alf::Lz4Compressor<IChT,ITrT,OChT,OTrT>::
+compress(span<const cin_char_type> in, span<cout_char_type> out,
+	 bool flush /* = false */)
+{
+  zresult res = { 0, 0, 0 };
+  if (out.len() == 0)
+    return res;
+  const unsigned char * ip;
+  unsigned char * op;
+  std::size_t ilen, olen;
+  B.begin(in, out, ip, ilen, op, olen);
+  std::size_t k_in = 0, k_out = 0;
+  for (;;) {
+    // first give out what we have.
+    std::size_t k = S.len() - spos;
+    if (k > olen - k_out) k = olen - k_out;
+    if (k)
+      std::memcpy(op + k_out, S.data() + spos, k);
+    k_out += k;
+    spos += k;
+    if (spos < S.len())
+      break; // out is full.
+    S.clear();
+    spos = 0;
+    if (ended)
+      break;
+    std::size_t cap;
+    if (! begun) {
+      cap = LZ4F_HEADER_SIZE_MAX;
+      ret = LZ4F_compressBegin(Z, S.get(cap), cap, &P);
+      begun = true;
+    } else if (k_in < ilen) {
+      std::size_t n = ilen - k_in;
+      if (n > BLOCKSZ) n = BLOCKSZ;
+      cap = LZ4F_compressBound(n, &P);
+      ret = LZ4F_compressUpdate(Z, S.get(cap), cap, ip + k_in, n, 0);
+      k_in += n;
+    } else if (flush) {
+      cap = LZ4F_compressBound(0, &P);
+      ret = LZ4F_compressEnd(Z, S.get(cap), cap, 0);
+      ended = true;
+    } else
+      break;
+    if (LZ4F_isError(ret)) {
+      res.ret = -1;
+      return res;
+    }
+    S.inclen(ret);
+  }
+  // done with the frame when all of it is out.
+  bool done = ended && S.len() == 0;
+  res = B.done(k_in, k_out, done);
+  if (done) {
+    begun = ended = false;
+    res.ret = 1;
+  }
+  return res;
+}
+
+/////////////////////////
+// Lz4Decompressor
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::Lz4Decompressor<OChT,OTrT,IChT,ITrT>::
+Lz4Decompressor(std::size_t chunk /* = 8192 */)
+  : Z(0), ret(0), chunk_(chunk != 0 ? chunk : 1)
+{
+  ret = LZ4F_createDecompressionContext(&Z, LZ4F_VERSION);
+  if (LZ4F_isError(ret))
+    throw "LZ4F_createDecompressionContext failed";
+  ret = 0;
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::Lz4Decompressor<OChT,OTrT,IChT,ITrT> &
+alf::Lz4Decompressor<OChT,OTrT,IChT,ITrT>::reset()
+{
+  LZ4F_resetDecompressionContext(Z);
+  ret = 0;
+  B.clear();
+  return *this;
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::zresult
+alf::Lz4Decompressor<OChT,OTrT,IChT,ITrT>::
+decompress(span<const din_char_type> in, span<dout_char_type> out,
+	   bool flush /* = false */)
+{
+  zresult res = { 0, 0, 0 };
+  if (out.len() == 0)
+    return res;
+  const unsigned char * ip;
+  unsigned char * op;
+  std::size_t ilen, olen;
+  B.begin(in, out, ip, ilen, op, olen);
+  std::size_t k_in = 0, k_out = 0;
+  // lz4 may keep output back when out is full, keep calling until
+  // out is full or nothing moves. Between frames (ret == 0) there is
+  // nothing to get without input, and a call would only give us the
+  // size of the next frame header instead of the 0 we have.
+  while (k_out < olen && (k_in < ilen || ret != 0)) {
+    std::size_t sn = ilen - k_in, dn = olen - k_out;
+    std::size_t r = LZ4F_decompress(Z, op + k_out, &dn, ip + k_in, &sn, 0);
+    if (LZ4F_isError(r)) {
+      ret = r;
+      res.ret = -1;
+      return res;
+    }
+    // r is a hint of how much input it wants, 0 between frames.
+    ret = r;
+    k_in += sn;
+    k_out += dn;
+    if (sn == 0 && dn == 0)
+      break;
+  }
+  // at the end of the input we should be between frames.
+  if (flush && ilen == 0 && k_out == 0 && ret != 0) {
+    res.ret = -1;
+    return res;
+  }
+  return B.done(k_in, k_out, flush && k_in == ilen && ret == 0);
+}
+
+#endif // ZSTREAM_WITH_LZ4
+
+/////////////////////////
+// AutoDecompressor
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT>::~AutoDecompressor()
+{
+  delete Z_;
+#ifdef ZSTREAM_WITH_ZSTD
+  delete S_;
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  delete L_;
+#endif
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT> &
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT>::reset()
+{
+  // keep the decompressors we have, the next data may need them.
+  if (Z_ != 0) Z_->reset();
+#ifdef ZSTREAM_WITH_ZSTD
+  if (S_ != 0) S_->reset();
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  if (L_ != 0) L_->reset();
+#endif
+  F = UNKNOWN;
+  nhead = hpos = 0;
+  return *this;
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+const char *
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT>::msg() const
+{
+  switch (F) {
+  case ZLIB:
+  case GZIP:
+    return Z_->msg();
+#ifdef ZSTREAM_WITH_ZSTD
+  case ZSTD:
+    return S_->msg();
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  case LZ4:
+    return L_->msg();
+#endif
+  default:
+    return nhead != 0 ? "unknown or unsupported format" : 0;
+  }
+}
+
+// see what head is and get the decompressor for it, < 0 if we can't.
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+int
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT>::start_()
+{
+  unsigned char m[4] = { 0, 0, 0, 0 };
+  std::size_t k = nhead * sizeof(din_char_type);
+  std::memcpy(m, head, k < 4 ? k : 4);
+  if (k >= 2 && m[0] == 0x1f && m[1] == 0x8b)
+    F = GZIP;
+  else if (k >= 2 && (m[0] & 0x0f) == Z_DEFLATED &&
+	   ((m[0] << 8) | m[1]) % 31 == 0)
+    F = ZLIB;
+  else if (k >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f &&
+	   m[3] == 0xfd)
+    F = ZSTD;
+  else if (k >= 4 && m[0] == 0x04 && m[1] == 0x22 && m[2] == 0x4d &&
+	   m[3] == 0x18)
+    F = LZ4;
+  switch (F) {
+  case ZLIB:
+  case GZIP:
+    if (Z_ == 0)
+      Z_ = new DefaultDecompressor<OChT,OTrT,IChT,ITrT>(O);
+    return 0;
+#ifdef ZSTREAM_WITH_ZSTD
+  case ZSTD:
+    if (S_ == 0)
+      S_ = new ZstdDecompressor<OChT,OTrT,IChT,ITrT>(O.chunk());
+    return 0;
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  case LZ4:
+    if (L_ == 0)
+      L_ = new Lz4Decompressor<OChT,OTrT,IChT,ITrT>(O.chunk());
+    return 0;
+#endif
+  default:
+    F = UNKNOWN;
+    return -1;
+  }
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::zresult
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT>::
+inner_(span<const din_char_type> in, span<dout_char_type> out, bool flush)
+{
+  switch (F) {
+#ifdef ZSTREAM_WITH_ZSTD
+  case ZSTD:
+    return S_->decompress(in, out, flush);
+#endif
+#ifdef ZSTREAM_WITH_LZ4
+  case LZ4:
+    return L_->decompress(in, out, flush);
+#endif
+  default:
+    return Z_->decompress(in, out, flush);
+  }
+}
+
+template <typename OChT, typename OTrT, typename IChT, typename ITrT>
+alf::zresult
+alf::AutoDecompressor<OChT,OTrT,IChT,ITrT>::
+decompress(span<const din_char_type> in, span<dout_char_type> out,
+	   bool flush /* = false */)
+{
+  zresult res = { 0, 0, 0 };
+  if (F == UNKNOWN) {
+    // collect the first chars until we can tell what it is.
+    while (nhead < HEADLEN && res.consumed < in.len())
+      head[nhead++] = in.data()[res.consumed++];
+    if (nhead < HEADLEN && ! flush)
+      return res;
+    if (nhead == 0)
+      return res; // no data at all.
+    if (start_() < 0) {
+      res.ret = -1;
+      return res;
+    }
+  }
+  bool last = flush && res.consumed == in.len();
+  if (hpos < nhead) {
+    // the chars we took to look at go first.
+    zresult z = inner_(span<const din_char_type>(head + hpos, nhead - hpos),
+		       out, last);
+    if (z.ret < 0)
+      return z;
+    hpos += z.consumed;
+    res.produced = z.produced;
+    res.ret = z.ret;
+    if (hpos < nhead || z.ret > 0 || z.produced == out.len())
+      return res;
+  }
+  zresult z =
+    inner_(span<const din_char_type>(in.data() + res.consumed,
+				     in.len() - res.consumed),
+	   span<dout_char_type>(out.data() + res.produced,
+				out.len() - res.produced), flush);
+  if (z.ret < 0)
+    return z;
+  res.consumed += z.consumed;
+  res.produced += z.produced;
+  res.ret = z.ret;
+  return res;
+}